@@ -27,5 +27,10 @@ public:
         return (void *)ptr;
     }
 
+    // Invalidates all previous allocations at once.
+    void reset() {
+        data = begin;
+    }
+
     // TODO: void deallocate(T* p, std::size_t n);
 };
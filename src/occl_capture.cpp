@@ -0,0 +1,264 @@
+#include "occl_capture.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+Occl_Capture_Writer::Occl_Capture_Writer(FILE *file, const BBox& clip_box, u64 reserve) : file(file) {
+    f32 box[4] = {clip_box.tl.x, clip_box.tl.y, clip_box.br.x, clip_box.br.y};
+
+    fwrite(&occl_capture_magic, sizeof(u32), 1, file);
+    fwrite(&occl_capture_version, sizeof(u32), 1, file);
+    fwrite(box, sizeof(box), 1, file);
+    fwrite(&reserve, sizeof(u64), 1, file);
+}
+
+Occl_Capture_Writer::~Occl_Capture_Writer() {
+    fclose(file);
+}
+
+static void write_hull(FILE *file, std::span<const glm::vec2> convex_hull) {
+    u32 count = (u32)convex_hull.size();
+    fwrite(&count, sizeof(u32), 1, file);
+
+    for (const glm::vec2& p: convex_hull) {
+        f32 pt[2] = {p.x, p.y};
+        fwrite(pt, sizeof(pt), 1, file);
+    }
+}
+
+void Occl_Capture_Writer::add_mesh(std::span<const glm::vec2> convex_hull, int sector) {
+    u8 tag = (u8)((sector == 0) ? Occl_Capture_Tag::ADD_MESH : Occl_Capture_Tag::ADD_SECTOR_MESH);
+    i32 s = sector;
+
+    fwrite(&tag, sizeof(u8), 1, file);
+    if (sector != 0) {
+        fwrite(&s, sizeof(i32), 1, file);
+    }
+
+    write_hull(file, convex_hull);
+}
+
+void Occl_Capture_Writer::update_mesh(int index, std::span<const glm::vec2> convex_hull) {
+    u8 tag = (u8)Occl_Capture_Tag::UPDATE_MESH;
+    i32 idx = index;
+
+    fwrite(&tag, sizeof(u8), 1, file);
+    fwrite(&idx, sizeof(i32), 1, file);
+    write_hull(file, convex_hull);
+}
+
+void Occl_Capture_Writer::mark_dirty(const BBox& bbox) {
+    u8 tag = (u8)Occl_Capture_Tag::MARK_DIRTY;
+    f32 box[4] = {bbox.tl.x, bbox.tl.y, bbox.br.x, bbox.br.y};
+
+    fwrite(&tag, sizeof(u8), 1, file);
+    fwrite(box, sizeof(box), 1, file);
+}
+
+void Occl_Capture_Writer::unload_sector(int sector) {
+    u8 tag = (u8)Occl_Capture_Tag::UNLOAD_SECTOR;
+    i32 s = sector;
+
+    fwrite(&tag, sizeof(u8), 1, file);
+    fwrite(&s, sizeof(i32), 1, file);
+}
+
+void Occl_Capture_Writer::flag_mesh(int index, Occl_Cull_Flag flag) {
+    u8 tag = (u8)Occl_Capture_Tag::FLAG_MESH;
+    i32 idx = index;
+    u8 f = (u8)flag;
+
+    fwrite(&tag, sizeof(u8), 1, file);
+    fwrite(&idx, sizeof(i32), 1, file);
+    fwrite(&f, sizeof(u8), 1, file);
+}
+
+void Occl_Capture_Writer::begin_frame() {
+    u8 tag = (u8)Occl_Capture_Tag::BEGIN_FRAME;
+    fwrite(&tag, sizeof(u8), 1, file);
+}
+
+void Occl_Capture_Writer::end_frame() {
+    u8 tag = (u8)Occl_Capture_Tag::END_FRAME;
+    fwrite(&tag, sizeof(u8), 1, file);
+}
+
+void Occl_Capture_Writer::select_occluders(int budget, const std::vector<int>& candidates) {
+    u8 tag = (u8)Occl_Capture_Tag::SELECT_OCCLUDERS;
+    i32 b = budget;
+    u32 count = (u32)candidates.size();
+
+    fwrite(&tag, sizeof(u8), 1, file);
+    fwrite(&b, sizeof(i32), 1, file);
+    fwrite(&count, sizeof(u32), 1, file);
+
+    for (int index: candidates) {
+        i32 idx = index;
+        fwrite(&idx, sizeof(i32), 1, file);
+    }
+}
+
+Occl_Capture_Reader::Occl_Capture_Reader() : data(null), size(0), cursor(0), clip_box{}, reserve(0) {}
+
+Occl_Capture_Reader::~Occl_Capture_Reader() {
+    if (data != null) {
+        munmap((void *)data, size);
+    }
+}
+
+bool Occl_Capture_Reader::open(const char *path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        print_error("Failed to open capture '%s'.\n", path);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        print_error("Failed to stat capture '%s'.\n", path);
+        close(fd);
+        return false;
+    }
+
+    void *mapped = mmap(null, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapped == MAP_FAILED) {
+        print_error("Failed to map capture '%s'.\n", path);
+        return false;
+    }
+
+    data = (const u8 *)mapped;
+    size = (size_t)st.st_size;
+    madvise(mapped, size, MADV_SEQUENTIAL);
+
+    u32 magic, version;
+    f32 box[4];
+    cursor = 0;
+
+    if (!read(&magic, sizeof(u32)) || !read(&version, sizeof(u32)) || !read(box, sizeof(box)) || !read(&reserve, sizeof(u64))) {
+        print_error("Capture '%s' is truncated.\n", path);
+        return false;
+    }
+
+    if (magic != occl_capture_magic || version == 0 || version > occl_capture_version) {
+        print_error("Capture '%s' has an unknown format (magic %08x, version %u).\n", path, magic, version);
+        return false;
+    }
+
+    clip_box = {{box[0], box[1]}, {box[2], box[3]}};
+    return true;
+}
+
+void Occl_Capture_Reader::rewind() {
+    // Skip the header.
+    cursor = 2 * sizeof(u32) + 4 * sizeof(f32) + sizeof(u64);
+}
+
+bool Occl_Capture_Reader::next(Occl_Capture_Record& record) {
+    u8 tag;
+    if (!read(&tag, sizeof(u8))) {
+        return false;
+    }
+
+    record.tag = (Occl_Capture_Tag)tag;
+
+    switch (record.tag) {
+        case Occl_Capture_Tag::ADD_MESH:
+        case Occl_Capture_Tag::ADD_SECTOR_MESH:
+        case Occl_Capture_Tag::UPDATE_MESH: {
+            // The sector of added meshes and the index of updated ones.
+            i32 prefix = 0;
+            if (record.tag != Occl_Capture_Tag::ADD_MESH && !read(&prefix, sizeof(i32))) {
+                return false;
+            }
+
+            record.sector = (record.tag == Occl_Capture_Tag::UPDATE_MESH) ? 0 : prefix;
+            record.index = prefix;
+
+            u32 count;
+            if (!read(&count, sizeof(u32)) || cursor + (size_t)count * 2 * sizeof(f32) > size) {
+                return false;
+            }
+
+            // The records are packed, so the floats may be unaligned.
+            record.convex_hull.resize(count);
+            for (u32 i = 0; i < count; i++) {
+                f32 pt[2];
+                if (!read(pt, sizeof(pt))) {
+                    return false;
+                }
+
+                record.convex_hull[i] = {pt[0], pt[1]};
+            }
+
+            return true;
+        }
+        case Occl_Capture_Tag::FLAG_MESH: {
+            i32 index;
+            u8 flag;
+            if (!read(&index, sizeof(i32)) || !read(&flag, sizeof(u8))) {
+                return false;
+            }
+
+            record.index = index;
+            record.flag = (Occl_Cull_Flag)flag;
+            return true;
+        }
+        case Occl_Capture_Tag::BEGIN_FRAME:
+        case Occl_Capture_Tag::END_FRAME:
+            return true;
+        case Occl_Capture_Tag::MARK_DIRTY: {
+            f32 box[4];
+            if (!read(box, sizeof(box))) {
+                return false;
+            }
+
+            record.bbox = {{box[0], box[1]}, {box[2], box[3]}};
+            return true;
+        }
+        case Occl_Capture_Tag::UNLOAD_SECTOR: {
+            i32 sector;
+            if (!read(&sector, sizeof(i32))) {
+                return false;
+            }
+
+            record.sector = sector;
+            return true;
+        }
+        case Occl_Capture_Tag::SELECT_OCCLUDERS: {
+            i32 budget;
+            u32 count;
+            if (!read(&budget, sizeof(i32)) || !read(&count, sizeof(u32)) || cursor + (size_t)count * sizeof(i32) > size) {
+                return false;
+            }
+
+            record.budget = budget;
+            record.candidates.resize(count);
+            for (u32 i = 0; i < count; i++) {
+                i32 index;
+                if (!read(&index, sizeof(i32))) {
+                    return false;
+                }
+
+                record.candidates[i] = index;
+            }
+
+            return true;
+        }
+    }
+
+    print_error("Unknown capture record tag %u at offset %zu.\n", tag, cursor - 1);
+    return false;
+}
+
+bool Occl_Capture_Reader::read(void *dst, size_t n) {
+    if (cursor + n > size) {
+        return false;
+    }
+
+    memcpy(dst, data + cursor, n);
+    cursor += n;
+    return true;
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include "occl_cull.h"
+#include <glm/vec2.hpp>
+
+// Binary capture of a culling session, so field frames can be replayed
+// offline. The layout is packed and native endian:
+//
+//   header:  u32 magic, u32 version, f32 clip_box[4], u64 reserve
+//   records: u8 tag, followed by
+//     ADD_MESH:    u32 vertex count, vertex count * f32[2]
+//     FLAG_MESH:   i32 index, u8 flag
+//     BEGIN_FRAME: nothing
+//     END_FRAME:   nothing
+//     SELECT_OCCLUDERS: i32 budget, u32 candidate count, candidate count * i32
+//     ADD_SECTOR_MESH: i32 sector, then as ADD_MESH, which is used for sector 0
+//     UNLOAD_SECTOR: i32 sector
+//     UPDATE_MESH: i32 index, then as ADD_MESH
+//     MARK_DIRTY:  f32 bbox[4]
+
+constexpr u32 occl_capture_magic = 0x5043434f; // "OCCP"
+constexpr u32 occl_capture_version = 5; // Older versions only lack records, so they are read as well.
+// Placeholders for the free mesh slots at the start of a capture.
+constexpr int occl_capture_free_sector = -2;
+
+enum class Occl_Capture_Tag : u8 {
+    ADD_MESH = 1,
+    FLAG_MESH = 2,
+    BEGIN_FRAME = 3,
+    END_FRAME = 4,
+    SELECT_OCCLUDERS = 5,
+    ADD_SECTOR_MESH = 6,
+    UNLOAD_SECTOR = 7,
+    UPDATE_MESH = 8,
+    MARK_DIRTY = 9
+};
+
+struct Occl_Capture_Writer {
+    FILE *file;
+
+    Occl_Capture_Writer(FILE *file, const BBox& clip_box, u64 reserve);
+    ~Occl_Capture_Writer();
+
+    Occl_Capture_Writer(const Occl_Capture_Writer&) = delete;
+    void operator=(const Occl_Capture_Writer&) = delete;
+
+    void add_mesh(std::span<const glm::vec2> convex_hull, int sector);
+    void unload_sector(int sector);
+    void update_mesh(int index, std::span<const glm::vec2> convex_hull);
+    void mark_dirty(const BBox& bbox);
+    void flag_mesh(int index, Occl_Cull_Flag flag);
+    void begin_frame();
+    void end_frame();
+    void select_occluders(int budget, const std::vector<int>& candidates);
+};
+
+struct Occl_Capture_Record {
+    Occl_Capture_Tag tag;
+    std::vector<glm::vec2> convex_hull; // ADD_MESH, ADD_SECTOR_MESH and UPDATE_MESH only.
+    int sector;                         // ADD_MESH, ADD_SECTOR_MESH and UNLOAD_SECTOR only.
+    int index;                          // FLAG_MESH and UPDATE_MESH only.
+    BBox bbox;                          // MARK_DIRTY only.
+    Occl_Cull_Flag flag;                // FLAG_MESH only.
+    int budget;                         // SELECT_OCCLUDERS only.
+    std::vector<int> candidates;        // SELECT_OCCLUDERS only.
+};
+
+// Reads a capture through a read-only memory mapping of the whole file.
+struct Occl_Capture_Reader {
+    const u8 *data;
+    size_t size;
+    size_t cursor;
+
+    BBox clip_box;
+    u64 reserve;
+
+    Occl_Capture_Reader();
+    ~Occl_Capture_Reader();
+
+    Occl_Capture_Reader(const Occl_Capture_Reader&) = delete;
+    void operator=(const Occl_Capture_Reader&) = delete;
+
+    bool open(const char *path);
+    void rewind();
+    // Returns false at the end of the capture or on a truncated record.
+    bool next(Occl_Capture_Record& record);
+
+private:
+    bool read(void *dst, size_t n);
+};
@@ -1,10 +1,14 @@
 #include "occl_cull.h"
+#include "occl_capture.h"
+#include "occl_trace.h"
 #include <glm/vec2.hpp>
 #include <glm/gtx/string_cast.hpp>
 #include <glm/gtx/norm.hpp>
 #include <cmath>
 #include <string.h>
 #include <queue>
+#include <algorithm>
+#include <bit>
 
 #define DEBUG false
 
@@ -14,10 +18,9 @@
 #define DEBUG_PRINT(...)
 #endif
 
-inline bool bbox_intersect(const BBox& a, const BBox& b) {
-    return !(b.tl.x > a.br.x || b.br.x < a.tl.x
-                || b.tl.y > a.br.y || b.br.y < a.tl.y);
-}
+#if OCCL_STATS
+thread_local Occl_Cull_Stats *occl_active_stats = null;
+#endif
 
 std::string to_string(const glm::vec2& v) {
     char str[256];
@@ -57,6 +60,35 @@ void print(const std::vector<glm::vec2>& pts) {
     printf("}\n");
 }
 
+void print(const Occl_Cull_Stats& stats) {
+    constexpr const char *phase_names[(int)Occl_Phase::COUNT] = {
+        "self_test", "occluder_insert", "draw_query", "fast_flag", "slow_flag"
+    };
+
+    printf("occluded %d, fast %d, slow %d, seeded %d, revived %d, unselected %d, cached %d, evicted %d\n", stats.total_occluded, stats.total_fast, stats.total_slow,
+        stats.total_seeded, stats.total_revived, stats.total_unselected, stats.total_cached, stats.total_evicted);
+    printf("flag calls %llu, nodes visited %llu, inside_fast %llu/%llu hits, slow path %llu, subtractions %llu, tri_in_mesh %llu, triangulations %llu, budget exhausted %llu\n",
+        (unsigned long long)stats.flag_calls, (unsigned long long)stats.nodes_visited,
+        (unsigned long long)stats.inside_fast_hits, (unsigned long long)stats.inside_fast_calls,
+        (unsigned long long)stats.slow_path_calls, (unsigned long long)stats.subtract_calls, (unsigned long long)stats.tri_in_mesh_calls,
+        (unsigned long long)stats.triangulations, (unsigned long long)stats.budget_exhausted);
+    printf("remainders merged away %llu, subtractions skipped as disjoint %llu, as inside %llu, coverage mask hits %llu\n",
+        (unsigned long long)stats.remainders_merged, (unsigned long long)stats.sat_disjoint, (unsigned long long)stats.sat_inside,
+        (unsigned long long)stats.mask_hits);
+
+    printf("remainders:");
+    for (int i = 0; i < occl_rem_histogram_size; i++) {
+        printf(" [<%d] %llu", 1 << i, (unsigned long long)stats.rem_histogram[i]);
+    }
+    printf("\n");
+
+    printf("cycles:");
+    for (int i = 0; i < (int)Occl_Phase::COUNT; i++) {
+        printf(" %s %llu", phase_names[i], (unsigned long long)stats.phase_cycles[i]);
+    }
+    printf("\n");
+}
+
 struct line {
     glm::vec2 pts[2];
 };
@@ -100,6 +132,9 @@ f32 tri_area(const triangle& tri) {
     return 0.5f * std::abs(glm::determinant(m));
 }
 
+// subtract_triangles drops remainders flatter than this.
+constexpr f32 min_height_to_ground_ratio = 1e-2f; // TODO: This might be a bad heuristic!
+
 f32 tri_min_height_to_ground_ratio(const triangle& tri) {
     f32 min_ratio = 999999.0f;
 
@@ -137,6 +172,18 @@ f32 tri_proximity_to(const triangle& tri, const glm::vec2& pt) {
     return max;
 }
 
+// Same as above, but with the cached normals and side lengths.
+f32 tri_proximity_to(const prepared_triangle& tri, const glm::vec2& pt) {
+    f32 max = -99999.0f;
+
+    for (int i = 0; i < 3; i++) {
+        f32 height = f32_eq(tri.side_lens[i], 0.0f) ? 0.0f : glm::dot(pt - tri.tri.pts[i], tri.normals[i]) / tri.side_lens[i];
+        max = std::max(height, max);
+    }
+
+    return max;
+}
+
 inline bool tri_inside(f32 proximity, f32 e = 1e-4) {
     return proximity < e;
 }
@@ -158,7 +205,7 @@ triangle triangle_align_corners(const triangle& a, const triangle& b) {
 }
 
 void tris_from_cc_quadrilateral(std::vector<triangle>& tris, const quadrilateral&& q) {
-    if (tri_inside(tri_proximity_to({q.pts[0], q.pts[1], q.pts[3]}, q.pts[2]))) {
+    if (tri_inside(tri_proximity_to(triangle{q.pts[0], q.pts[1], q.pts[3]}, q.pts[2]))) {
         tris.push_back({{q.pts[0], q.pts[1], q.pts[2]}});
         tris.push_back({{q.pts[0], q.pts[2], q.pts[3]}});
     } else {
@@ -258,12 +305,12 @@ void normalize_wrt_norm_line(const glm::vec2& p0, const glm::vec2& p1,
     normalized[1] = glm::dot(p1 - norm_line_p, norm_line_dir) / len2_dir;
 }
 
-void line_get_inters_factor(const glm::vec2& p1, const glm::vec2& d1, const glm::vec2& p2, const glm::vec2& d2, f32 inters_facs[2]) {
+void line_get_inters_factor(const glm::vec2& p1, const glm::vec2& d1, f32 len1, const glm::vec2& p2, const glm::vec2& d2, f32 len2, f32 inters_facs[2]) {
     glm::mat2 m;
     m[0] = d1;
     m[1] = -d2;
 
-    f32 len_mul = glm::length(d1) * glm::length(d2); // Very large and very small d1, d2 vectors must be accounted for.
+    f32 len_mul = len1 * len2; // Very large and very small d1, d2 vectors must be accounted for.
     if (f32_eq(glm::determinant(m), 0.0f, len_mul * 1e-3)) {
         inters_facs[0] = inters_facs[1] = F32_NAN;
     } else {
@@ -279,21 +326,22 @@ void line_get_inters_factor(const glm::vec2& p1, const glm::vec2& d1, const glm:
     }
 }
 
-void tris_get_inters(const triangle& minuend, const triangle& subtr, f32 fac_arr[], int inters_indices[], int& inters_count) {
+void tris_get_inters(const triangle& minuend, const prepared_triangle& subtr, f32 fac_arr[], int inters_indices[], int& inters_count) {
     glm::vec2 minuend_sides[3];
-    glm::vec2 subtr_sides[3];
+    f32 minuend_side_lens[3];
     
     for (int i = 0; i < 3; i++) {
         minuend_sides[i] = minuend.pts[(i + 1) % 3] - minuend.pts[i];
-        subtr_sides[i] = subtr.pts[(i + 1) % 3] - subtr.pts[i];
+        minuend_side_lens[i] = glm::length(minuend_sides[i]);
     }
 
     f32 full_fac_arr[fac_arr_size][2];
     for (int i = 0; i < 9; i++) {
-        int m = minuend_side(i);;
+        int m = minuend_side(i);
         int s = subtr_side(i);
 
-        line_get_inters_factor(minuend.pts[m], minuend_sides[m], subtr.pts[s], subtr_sides[s], full_fac_arr[i]);
+        line_get_inters_factor(minuend.pts[m], minuend_sides[m], minuend_side_lens[m], 
+            subtr.tri.pts[s], subtr.sides[s], subtr.side_lens[s], full_fac_arr[i]);
     }
 
     // TODO: This could be one large loop!
@@ -359,6 +407,19 @@ void tris_get_inters(const triangle& minuend, const triangle& subtr, f32 fac_arr
     }
 }
 
+template<int(*FUNC)(int)>
+bool sides_have_max_2_inters(int inters_indices[], int inters_count) {
+    int side_icount[3] = {};
+
+    for (int i = 0; i < inters_count; i++) {
+        if (++side_icount[FUNC(inters_indices[i])] > 2) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 template<int(*FUNC)(int)>
 void get_side_to_inters(int side_inters[3][2], int side_icount[3], int inters_indices[], int inters_count) {
     for (int i = 0; i < inters_count; i++) {
@@ -371,7 +432,8 @@ void get_side_to_inters(int side_inters[3][2], int side_icount[3], int inters_in
 #define PROX_OUTSIDE 1
 
 // Returns whether the start point was chosen confidently.
-bool tri_choose_start_point(const triangle& tri, const triangle& ref, int &start_pt, int &start_flag) {
+template<typename REF>
+bool tri_choose_start_point(const triangle& tri, const REF& ref, int &start_pt, int &start_flag) {
     // Calculate the distance if the tri point is inside or outside the ref triangle.
     // Then choose the larger one.
 
@@ -420,7 +482,7 @@ bool sort_with_max_2_elements(int i, f32 fac_arr[], int side_inters[3][2], int s
     return false;
 }
 
-void get_mll_inters_and_walk_minuend(const triangle& minuend, const triangle& subtr, f32 fac_arr[fac_arr_size], int inters_indices[], int& inters_count, 
+void get_mll_inters_and_walk_minuend(const triangle& minuend, const prepared_triangle& subtr, f32 fac_arr[fac_arr_size], int inters_indices[], int& inters_count, 
     int mll_inters_indices[], int& mll_inters_count, int minuend_outside_indices[3], int& minuend_outside_count, int side_inters[3][2], int side_icount[3]) {
     get_side_to_inters<minuend_side>(side_inters, side_icount, inters_indices, inters_count);
 
@@ -543,17 +605,97 @@ void walk_subtr(const triangle& minuend, const triangle& subtr, int inters_indic
     }
 }
 
-void internal_subtract_triangles(const triangle& minuend, const triangle& subtr, std::vector<triangle>& tris) {
-    if (!tri_is_winding_cc(minuend) || !tri_is_winding_cc(subtr)) {
-        DEBUG_PRINT("Invalid winding as input. %d, %d\n", tri_is_winding_cc(minuend), tri_is_winding_cc(subtr));
+enum class tri_overlap {
+    DISJOINT, // The minuend passes through unchanged.
+    INSIDE,   // Nothing of the minuend remains.
+    PARTIAL   // Needs the full subtraction.
+};
+
+// Separating axis test on the bboxes and the edge normals of both triangles. The tolerances lean
+// towards keeping the minuend: DISJOINT is returned even if the minuend reaches up to the tolerance
+// past a subtrahend side, or the subtrahend up to it past a minuend side. INSIDE is strict, every
+// point has to be more than the tolerance inside. Near the boundaries the minuend is kept or cut,
+// never dropped, so less counts as covered, which is conservative.
+tri_overlap tri_classify(const triangle& minuend, const prepared_triangle& subtr) {
+    // The bbox margin covers the tolerance of line_get_inters_factor.
+    BBox bbox = {glm::min(minuend.pts[0], glm::min(minuend.pts[1], minuend.pts[2])), glm::max(minuend.pts[0], glm::max(minuend.pts[1], minuend.pts[2]))};
+    glm::vec2 extent = (bbox.br - bbox.tl) + (subtr.bbox.br - subtr.bbox.tl);
+    f32 margin = 1e-3f * (extent.x + extent.y);
+
+    if (bbox.br.x + margin < subtr.bbox.tl.x || subtr.bbox.br.x + margin < bbox.tl.x
+        || bbox.br.y + margin < subtr.bbox.tl.y || subtr.bbox.br.y + margin < bbox.tl.y) {
+        return tri_overlap::DISJOINT;
+    }
+
+    // Heights along the unnormalized normals, positive outside. Scaling e by the side length
+    // makes the tolerance an absolute distance of e, inside and outside alike.
+    f32 e = 1e-6;
+    bool inside = true;
+
+    for (int i = 0; i < 3; i++) {
+        f32 min_height = 999999.0f, max_height = -999999.0f;
+        f32 tolerance = e * subtr.side_lens[i];
+
+        for (const glm::vec2& p: minuend.pts) {
+            f32 height = glm::dot(p - subtr.tri.pts[i], subtr.normals[i]);
+            min_height = std::min(min_height, height);
+            max_height = std::max(max_height, height);
+        }
+
+        if (min_height >= -tolerance) {
+            return tri_overlap::DISJOINT;
+        }
+
+        inside &= max_height <= -tolerance;
+    }
+
+    if (inside) {
+        return tri_overlap::INSIDE;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        glm::vec2 side = minuend.pts[(i + 1) % 3] - minuend.pts[i];
+        glm::vec2 normal = orth(side);
+        f32 min_height = 999999.0f;
+
+        for (const glm::vec2& p: subtr.tri.pts) {
+            min_height = std::min(min_height, glm::dot(p - minuend.pts[i], normal));
+        }
+
+        // Compared squared, so the side length needs no square root.
+        if (min_height >= 0.0f || min_height * min_height <= e * e * glm::length2(side)) {
+            return tri_overlap::DISJOINT;
+        }
+    }
+
+    return tri_overlap::PARTIAL;
+}
+
+void internal_subtract_triangles(const triangle& minuend, const prepared_triangle& prepared, std::vector<triangle>& tris) {
+    const triangle& subtr = prepared.tri;
+
+    if (!tri_is_winding_cc(minuend) || !prepared.winding_cc) {
+        DEBUG_PRINT("Invalid winding as input. %d, %d\n", tri_is_winding_cc(minuend), prepared.winding_cc);
         return;
     }
 
+    switch (tri_classify(minuend, prepared)) {
+        case tri_overlap::DISJOINT:
+            OCCL_STAT_ADD(sat_disjoint, 1);
+            tris.push_back(minuend);
+            return;
+        case tri_overlap::INSIDE:
+            OCCL_STAT_ADD(sat_inside, 1);
+            return;
+        case tri_overlap::PARTIAL:
+            break;
+    }
+
     // Other cases begin here.
     f32 fac_arr[fac_arr_size];
     int raw_inters_count = 0;
     int raw_inters_indices[fac_arr_size] = {};
-    tris_get_inters(minuend, subtr, fac_arr, raw_inters_indices, raw_inters_count);
+    tris_get_inters(minuend, prepared, fac_arr, raw_inters_indices, raw_inters_count);
 
 #if DEBUG
     DEBUG_PRINT("raw_inters_pts: ");
@@ -563,15 +705,28 @@ void internal_subtract_triangles(const triangle& minuend, const triangle& subtr,
     DEBUG_PRINT("\n");
 #endif
 
+    // Nearly collinear sides can intersect one side three times. None of the cases below handle that.
+    if (!sides_have_max_2_inters<minuend_side>(raw_inters_indices, raw_inters_count)) {
+        DEBUG_PRINT("Failed on (degenerate minuend side): {%s}, {%s}\n", to_string(minuend).c_str(), to_string(subtr).c_str());
+        tris.push_back(minuend);
+        return;
+    }
+
     int minuend_outside_indices[3] = {};
     int minuend_outside_count = 0;
     int inters_count = 0;
     int inters_indices[fac_arr_size] = {};
     int minuend_side_inters[3][2] = {};
     int minuend_side_icount[3] = {};
-    get_mll_inters_and_walk_minuend(minuend, subtr, fac_arr, raw_inters_indices, raw_inters_count, inters_indices, inters_count, 
+    get_mll_inters_and_walk_minuend(minuend, prepared, fac_arr, raw_inters_indices, raw_inters_count, inters_indices, inters_count, 
         minuend_outside_indices, minuend_outside_count, minuend_side_inters, minuend_side_icount);
 
+    if (!sides_have_max_2_inters<subtr_side>(inters_indices, inters_count)) {
+        DEBUG_PRINT("Failed on (degenerate subtr. side): {%s}, {%s}\n", to_string(minuend).c_str(), to_string(subtr).c_str());
+        tris.push_back(minuend);
+        return;
+    }
+
     int subtr_inside_indices[3] = {};
     int subtr_inside_count = 0;
     int subtr_side_inters[3][2] = {}; 
@@ -768,20 +923,21 @@ void internal_subtract_triangles(const triangle& minuend, const triangle& subtr,
                 return;
             } else if (inters_count == 4) {
                 // Seperate subtr. side with two inters. and the other two.
-                int two_pt_side;
+                int two_pt_side = -1;
                 int other_sides[2];
                 int other_sides_count = 0;
 
                 for (int i = 0; i < 3; i++) {
                     if (subtr_side_icount[i] == 2) {
                         two_pt_side = i;
-                    } else {
-                        assert(subtr_side_icount[i] == 1);
+                    } else if (subtr_side_icount[i] == 1) {
                         other_sides[other_sides_count++] = i;
+                    } else {
+                        goto case_missed;
                     }
                 }
 
-                assert(other_sides_count == 2);
+                if (two_pt_side < 0 || other_sides_count != 2) goto case_missed;
 
                 int common_points[2] = {
                     tri_get_common_point_of_sides(minuend_side(subtr_side_inters[two_pt_side][0]), minuend_side(subtr_side_inters[two_pt_side][1])),
@@ -825,7 +981,7 @@ void internal_subtract_triangles(const triangle& minuend, const triangle& subtr,
         }
     } else if (minuend_outside_count == 1) {
         if (subtr_outside) {
-            assert(inters_count == 2);
+            if (inters_count != 2) goto case_missed;
             line inters = tri_next_two_inters_points(minuend.pts, fac_arr, inters_indices);
 
             triangle minuend_cutoff = {minuend.pts[minuend_outside_indices[0]], inters.pts[0], inters.pts[1]}; 
@@ -835,7 +991,7 @@ void internal_subtract_triangles(const triangle& minuend, const triangle& subtr,
 
             return;
         } else if (subtr_inside_count == 2) {
-            assert(inters_count == 2);
+            if (inters_count != 2) goto case_missed;
             line inters = tri_next_two_inters_points(minuend.pts, fac_arr, inters_indices);
 
             // TODO: Ugly! Make this nicer! marker
@@ -876,11 +1032,33 @@ void internal_subtract_triangles(const triangle& minuend, const triangle& subtr,
         printf("Not a good lawyer 12938878!\n");
     }
 
+case_missed:
     printf("Failed on (case missed): {%s}, {%s}\n", to_string(minuend).c_str(), to_string(subtr).c_str());
     tris.push_back(minuend); // Return something other than {} so tests fail initially.
 }
 
+prepared_triangle prepare_triangle(const triangle& tri) {
+    prepared_triangle prepared;
+    prepared.tri = tri;
+
+    for (int i = 0; i < 3; i++) {
+        prepared.sides[i] = tri.pts[(i + 1) % 3] - tri.pts[i];
+        prepared.normals[i] = orth(prepared.sides[i]);
+        prepared.side_lens[i] = glm::length(prepared.sides[i]);
+    }
+
+    prepared.bbox = {glm::min(tri.pts[0], glm::min(tri.pts[1], tri.pts[2])), glm::max(tri.pts[0], glm::max(tri.pts[1], tri.pts[2]))};
+    prepared.area = tri_area(tri);
+    prepared.winding_cc = tri_is_winding_cc(tri);
+    return prepared;
+}
+
 void subtract_triangles(const triangle& minuend, const triangle& subtr, std::vector<triangle>& tris) {
+    subtract_triangles(minuend, prepare_triangle(subtr), tris);
+}
+
+void subtract_triangles(const triangle& minuend, const prepared_triangle& subtr, std::vector<triangle>& tris) {
+    OCCL_STAT_ADD(subtract_calls, 1);
     int start_idx = (int)tris.size();
     internal_subtract_triangles(minuend, subtr, tris);
 
@@ -889,8 +1067,7 @@ void subtract_triangles(const triangle& minuend, const triangle& subtr, std::vec
         const triangle& tri = tris[i];
             
         f32 e = 1e-7; // 1e-8 is smaller than the smallest f32 representable number other than 0. TODO: Numerically dubious.
-        f32 min_ratio = 1e-2; // TODO: This might be a bad heuristic!
-        if (tri_area(tri) < e || tri_min_height_to_ground_ratio(tri) < min_ratio || !tri_is_winding_cc(tri)) { // TODO: This might hide bugs.
+        if (tri_area(tri) < e || tri_min_height_to_ground_ratio(tri) < min_height_to_ground_ratio || !tri_is_winding_cc(tri)) { // TODO: This might hide bugs.
             DEBUG_PRINT("removed zero area triangle %s\n", to_string(tri).c_str());
             tris.erase(tris.begin() + i);
         }
@@ -901,7 +1078,7 @@ void subtract_triangles(const triangle& minuend, const triangle& subtr, std::vec
         const triangle& tri = tris[i];
         
         if (!tri_is_winding_cc(tri)) {
-            printf("Failed on (inv. winding): minuend {%s}, subtr. {%s}\n tris: ", to_string(minuend).c_str(), to_string(subtr).c_str());
+            printf("Failed on (inv. winding): minuend {%s}, subtr. {%s}\n tris: ", to_string(minuend).c_str(), to_string(subtr.tri).c_str());
             print(tris);
             printf("--------\n");
             break;
@@ -909,7 +1086,208 @@ void subtract_triangles(const triangle& minuend, const triangle& subtr, std::vec
     }
 }
 
-bool tri_in_mesh(const triangle& tri, const std::vector<triangle>& tris, f32 min_rem_area) {
+Occl_Work_Budget::Occl_Work_Budget(u64 max_subtractions, u64 max_cycles)
+    : max_subtractions(max_subtractions), max_cycles(max_cycles), subtractions(0),
+        start_cycles(max_cycles > 0 ? occl_read_cycles() : 0), exhausted(false) {}
+
+// Returns false once the budget is spent.
+bool Occl_Work_Budget::spend_subtraction() {
+    subtractions++;
+
+    if ((max_subtractions > 0 && subtractions > max_subtractions)
+        || (max_cycles > 0 && occl_read_cycles() - start_cycles > max_cycles)) {
+        OCCL_STAT_ADD(budget_exhausted, 1);
+        exhausted = true;
+        return false;
+    }
+
+    return true;
+}
+
+// Remainders are merged back into convex polygons of at most this many points.
+constexpr int max_merged_pts = 16;
+
+struct convex_polygon {
+    glm::vec2 pts[max_merged_pts];
+    int count;
+    BBox bbox;
+};
+
+// Sine of the turn at b, positive if a, b, c turn counter-clockwise.
+f32 turn_sine(const glm::vec2& a, const glm::vec2& b, const glm::vec2& c) {
+    glm::vec2 d0 = b - a;
+    glm::vec2 d1 = c - b;
+    f32 len_mul = glm::length(d0) * glm::length(d1);
+
+    return (len_mul == 0.0f) ? 0.0f : (d0.x * d1.y - d0.y * d1.x) / len_mul;
+}
+
+// Merges q into p, if they share an edge and their union is convex.
+bool polygons_merge(convex_polygon& p, const convex_polygon& q, f32 e2) {
+    if (p.bbox.br.x < q.bbox.tl.x || q.bbox.br.x < p.bbox.tl.x || p.bbox.br.y < q.bbox.tl.y || q.bbox.br.y < p.bbox.tl.y) {
+        return false;
+    }
+
+    for (int i = 0; i < p.count; i++) {
+        const glm::vec2& a = p.pts[i];
+        const glm::vec2& b = p.pts[(i + 1) % p.count];
+
+        for (int j = 0; j < q.count; j++) {
+            // Both are counter-clockwise, so a shared edge runs the other way in q.
+            if (glm::distance2(q.pts[j], b) >= e2 || glm::distance2(q.pts[(j + 1) % q.count], a) >= e2) {
+                continue;
+            }
+
+            // The union runs from b around p to a, then around q back to b.
+            glm::vec2 pts[2 * max_merged_pts];
+            int count = 0;
+
+            for (int k = 0; k < p.count; k++) pts[count++] = p.pts[(i + 1 + k) % p.count];
+            for (int k = 2; k < q.count; k++) pts[count++] = q.pts[(j + k) % q.count];
+
+            // Drop the points where the outline goes straight on, which are the ones the cuts added.
+            convex_polygon merged;
+            merged.count = 0;
+            bool convex = true;
+
+            for (int k = 0; k < count; k++) {
+                f32 sine = turn_sine(pts[(k + count - 1) % count], pts[k], pts[(k + 1) % count]);
+                f32 e = 1e-5;
+
+                if (sine < -e || (sine > e && merged.count == max_merged_pts)) {
+                    convex = false;
+                    break;
+                } else if (sine > e) {
+                    merged.pts[merged.count++] = pts[k];
+                }
+            }
+
+            if (!convex || merged.count < 3) {
+                return false;
+            }
+
+            merged.bbox = {glm::min(p.bbox.tl, q.bbox.tl), glm::max(p.bbox.br, q.bbox.br)};
+            p = merged;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Point to fan the polygon from with the fattest triangles, -1 if those would still be dropped
+// by subtract_triangles. Next to a nearly straight run of the outline the fan has slivers.
+int fan_apex(const convex_polygon& poly) {
+    int apex = -1;
+    f32 apex_ratio = min_height_to_ground_ratio;
+
+    for (int a = 0; a < poly.count; a++) {
+        f32 ratio = F32_INF;
+        for (int i = 1; i < poly.count - 1; i++) {
+            triangle tri = {{poly.pts[a], poly.pts[(a + i) % poly.count], poly.pts[(a + i + 1) % poly.count]}};
+            ratio = std::min(ratio, tri_min_height_to_ground_ratio(tri));
+        }
+
+        if (ratio >= apex_ratio) {
+            apex = a;
+            apex_ratio = ratio;
+        }
+    }
+
+    return apex;
+}
+
+// Merges remainders that share edges back into convex polygons and triangulates those as fans,
+// so the remainder count follows the uncovered shape and not the number of cuts so far.
+void merge_remainders(std::vector<triangle>& tris) {
+    BBox bbox = {tris[0].pts[0], tris[0].pts[0]};
+    for (const triangle& tri: tris) {
+        for (const glm::vec2& p: tri.pts) {
+            bbox = {glm::min(bbox.tl, p), glm::max(bbox.br, p)};
+        }
+    }
+
+    glm::vec2 extent = bbox.br - bbox.tl;
+    f32 e = 1e-5f * std::max(extent.x, extent.y);
+
+    thread_local std::vector<convex_polygon> polys;
+    polys.resize(tris.size());
+
+    for (size_t i = 0; i < tris.size(); i++) {
+        const triangle& tri = tris[i];
+        convex_polygon& poly = polys[i];
+
+        poly.count = 3;
+        std::copy(tri.pts, tri.pts + 3, poly.pts);
+        poly.bbox = {glm::min(tri.pts[0], glm::min(tri.pts[1], tri.pts[2])) - e, glm::max(tri.pts[0], glm::max(tri.pts[1], tri.pts[2])) + e};
+    }
+
+    bool merged = true;
+    while (merged) {
+        merged = false;
+
+        for (size_t i = 0; i < polys.size(); i++) {
+            for (size_t j = i + 1; j < polys.size();) {
+                if (polygons_merge(polys[i], polys[j], e * e)) {
+                    polys[j] = polys.back();
+                    polys.pop_back();
+                    merged = true;
+                } else {
+                    j++;
+                }
+            }
+        }
+    }
+
+    size_t tri_count = 0;
+    for (const convex_polygon& poly: polys) {
+        tri_count += poly.count - 2;
+    }
+
+    // Keep the input if merging does not save anything.
+    if (tri_count >= tris.size()) {
+        return;
+    }
+
+    // Dropped slivers would count as covered, so keep the input if some polygon has no fan without them.
+    // Unmerged triangles are fanned as they are.
+    thread_local std::vector<int> apexes;
+    apexes.resize(polys.size());
+
+    for (size_t p = 0; p < polys.size(); p++) {
+        apexes[p] = (polys[p].count == 3) ? 0 : fan_apex(polys[p]);
+        if (apexes[p] < 0) {
+            return;
+        }
+    }
+
+    OCCL_STAT_ADD(remainders_merged, tris.size() - tri_count);
+    tris.clear();
+
+    for (size_t p = 0; p < polys.size(); p++) {
+        const convex_polygon& poly = polys[p];
+        int a = apexes[p];
+
+        for (int i = 1; i < poly.count - 1; i++) {
+            tris.push_back({{poly.pts[a], poly.pts[(a + i) % poly.count], poly.pts[(a + i + 1) % poly.count]}});
+        }
+    }
+}
+
+bool tri_in_mesh(const triangle& tri, const std::vector<triangle>& tris, f32 min_rem_area, Occl_Work_Budget *budget) {
+    std::vector<prepared_triangle> prepared;
+    prepared.reserve(tris.size());
+
+    for (const triangle& t: tris) {
+        prepared.push_back(prepare_triangle(t));
+    }
+
+    return tri_in_mesh(tri, prepared, min_rem_area, budget);
+}
+
+bool tri_in_mesh(const triangle& tri, std::span<const prepared_triangle> tris, f32 min_rem_area, Occl_Work_Budget *budget) {
+    OCCL_TRACE_SCOPE("tri_in_mesh", "tris", (i64)tris.size());
+    OCCL_STAT_ADD(tri_in_mesh_calls, 1);
     f32 intersecting_area = 0.0f;
     std::queue<triangle> intersecting;
     
@@ -928,12 +1306,24 @@ bool tri_in_mesh(const triangle& tri, const std::vector<triangle>& tris, f32 min
             std::vector<triangle> next_remainders;
 
             for (size_t j = 0; j < curr_remainders.size(); j++) {
+                if (budget != null && !budget->spend_subtraction()) {
+                    return false;
+                }
+
                 subtract_triangles(curr_remainders[j], tris[i], next_remainders);
             }
 
+            // Only a round that cut the remainders up can have produced anything to merge.
+            bool cut = next_remainders.size() > curr_remainders.size();
             curr_remainders = std::move(next_remainders);
+
+            if (cut && curr_remainders.size() > 3) {
+                merge_remainders(curr_remainders);
+            }
         }
 
+        OCCL_STAT_REM_COUNT(curr_remainders.size());
+
         for (triangle& rem: curr_remainders) {
             intersecting_area += tri_area(rem);
             intersecting.push(rem);
@@ -948,19 +1338,135 @@ bool tri_in_mesh(const triangle& tri, const std::vector<triangle>& tris, f32 min
 }
 
 
-Occl_Mesh::Occl_Mesh(std::vector<glm::vec2> _convex_hull) : convex_hull(std::move(_convex_hull)) {
-    bbox = {{99999.0f, 99999.0f}, {-99999.0f, -99999.0f}};
+void Occl_Bitset::push_back(bool value) {
+    if (count % 64 == 0) {
+        words.push_back(0);
+    }
+
+    if (value) set(count);
+    count++;
+}
+
+void Occl_Bitset::compact(std::vector<int>& indices) const {
+    // Skips empty words whole and pops the set bits of the others lowest first.
+    for (size_t w = 0; w < words.size(); w++) {
+        for (u64 bits = words[w]; bits != 0; bits &= bits - 1) {
+            indices.push_back((int)(w * 64 + std::countr_zero(bits)));
+        }
+    }
+}
+
+Occl_Mesh_Pool::Occl_Mesh_Pool() : tri_chunk_used(tri_chunk_size), dead_pts(0) {}
+
+Occl_Mesh Occl_Mesh_Pool::add(std::span<const glm::vec2> convex_hull) {
+    Occl_Mesh mesh;
+    mesh.bbox = {{99999.0f, 99999.0f}, {-99999.0f, -99999.0f}};
+    mesh.pool = this;
+    mesh.id = (u32)tri_cache.size();
+    mesh.hull_offset = (u32)pts.size();
+    mesh.hull_count = (u32)convex_hull.size();
+    mesh.tri_count = (convex_hull.size() >= 3) ? (u32)convex_hull.size() - 2 : 0;
 
     for (const glm::vec2& p: convex_hull) {
-        bbox.tl = {std::min(bbox.tl.x, p.x), std::min(bbox.tl.y, p.y)};
-        bbox.br = {std::max(bbox.br.x, p.x), std::max(bbox.br.y, p.y)};
+        mesh.bbox.tl = {std::min(mesh.bbox.tl.x, p.x), std::min(mesh.bbox.tl.y, p.y)};
+        mesh.bbox.br = {std::max(mesh.bbox.br.x, p.x), std::max(mesh.bbox.br.y, p.y)};
     }
 
-    for (size_t i = 2; i < convex_hull.size(); i++) {
-        mesh_proj.push_back({convex_hull[i - 1], convex_hull[i], convex_hull[0]});
+    pts.insert(pts.end(), convex_hull.begin(), convex_hull.end());
+    tri_cache.emplace_back(null);
+
+    return mesh;
+}
+
+void Occl_Mesh_Pool::reserve(size_t mesh_count, size_t pts_per_mesh) {
+    pts.reserve(mesh_count * pts_per_mesh);
+}
+
+void Occl_Mesh_Pool::remove(const Occl_Mesh& mesh) {
+    assert(mesh.pool == this);
+    dead_pts += mesh.hull_count;
+}
+
+void Occl_Mesh_Pool::compact(std::span<Occl_Mesh> meshes) {
+    std::vector<glm::vec2> live_pts;
+    live_pts.reserve(pts.size() - dead_pts);
+
+    for (Occl_Mesh& mesh: meshes) {
+        assert(mesh.pool == this);
+        u32 offset = (u32)live_pts.size();
+
+        live_pts.insert(live_pts.end(), pts.begin() + mesh.hull_offset, pts.begin() + mesh.hull_offset + mesh.hull_count);
+
+        mesh.hull_offset = offset;
+    }
+
+    pts = std::move(live_pts);
+    dead_pts = 0;
+
+    // Triangles are rebuilt lazily, so only meshes that reach the slow path again pay for it.
+    tri_chunks.clear();
+    tri_chunk_used = tri_chunk_size;
+    tri_cache.clear();
+
+    for (Occl_Mesh& mesh: meshes) {
+        mesh.id = (u32)tri_cache.size();
+        tri_cache.emplace_back(null);
     }
 }
 
+void Occl_Mesh_Pool::clear() {
+    dead_pts = 0;
+    pts.clear();
+    tri_cache.clear();
+    tri_chunks.clear();
+    tri_chunk_used = tri_chunk_size;
+}
+
+const triangle *Occl_Mesh_Pool::triangulate(const Occl_Mesh& mesh) const {
+    std::lock_guard<std::mutex> lock(tri_mutex);
+
+    // Another thread might have been faster.
+    const triangle *cached = tri_cache[mesh.id].load(std::memory_order_relaxed);
+    if (cached != null) {
+        return cached;
+    }
+
+    triangle *tris;
+    if (mesh.tri_count > tri_chunk_size) {
+        // Too large for a chunk, it gets its own and the current one stays open.
+        tri_chunks.insert(tri_chunks.begin(), std::make_unique<triangle[]>(mesh.tri_count));
+        tris = tri_chunks.front().get();
+    } else {
+        if (tri_chunk_used + mesh.tri_count > tri_chunk_size) {
+            tri_chunks.push_back(std::make_unique<triangle[]>(tri_chunk_size));
+            tri_chunk_used = 0;
+        }
+
+        tris = tri_chunks.back().get() + tri_chunk_used;
+        tri_chunk_used += mesh.tri_count;
+    }
+
+    // Zig-zag strip instead of a fan, so no vertex is shared by all triangles and
+    // large hulls get fewer slivers. Indices stay in hull order, so every triangle
+    // is counter-clockwise like the hull.
+    std::span<const glm::vec2> hull = mesh.convex_hull();
+    u32 lo = 0, hi = mesh.hull_count - 1;
+
+    for (u32 t = 0; t < mesh.tri_count; t++) {
+        if (t % 2 == 0) {
+            tris[t] = {{hull[lo], hull[lo + 1], hull[hi]}};
+            lo++;
+        } else {
+            tris[t] = {{hull[lo], hull[hi - 1], hull[hi]}};
+            hi--;
+        }
+    }
+
+    OCCL_STAT_ADD(triangulations, 1);
+    tri_cache[mesh.id].store(tris, std::memory_order_release);
+    return tris;
+}
+
 int Occl_Mesh::compare(f32 value, uint dim) const {
     if (bbox.br[dim] < value) {
         return -1;
@@ -971,17 +1477,21 @@ int Occl_Mesh::compare(f32 value, uint dim) const {
     }
 }
 
-bool Occl_Mesh::inside_fast(const Occl_Mesh *other) {
+bool Occl_Mesh::inside_fast(const Occl_Mesh *other) const {
     // TODO: This could obviously be made even faster.
     // AVX2 for vectorization is possible.
+    OCCL_STAT_ADD(inside_fast_calls, 1);
+
+    std::span<const glm::vec2> hull = convex_hull();
+    std::span<const glm::vec2> other_hull = other->convex_hull();
 
-    for (size_t i = 0; i < other->convex_hull.size(); i++) {
-        const glm::vec2& curr = other->convex_hull[i];
-        const glm::vec2& next = other->convex_hull[(i + 1) % other->convex_hull.size()];
+    for (size_t i = 0; i < other_hull.size(); i++) {
+        const glm::vec2& curr = other_hull[i];
+        const glm::vec2& next = other_hull[(i + 1) % other_hull.size()];
         const glm::vec2 o = orth(next - curr);
 
-        for (size_t j = 0; j < convex_hull.size(); j++) {
-            f32 dot = glm::dot(convex_hull[j] - curr, o);
+        for (size_t j = 0; j < hull.size(); j++) {
+            f32 dot = glm::dot(hull[j] - curr, o);
 
             if (dot > 0) {
                 return false;
@@ -989,66 +1499,215 @@ bool Occl_Mesh::inside_fast(const Occl_Mesh *other) {
         }
     }
 
+    OCCL_STAT_ADD(inside_fast_hits, 1);
     return true;
 }
 
-bool Occl_Mesh::intersect(const Occl_Mesh *other) {
+bool Occl_Mesh::intersect(const Occl_Mesh *other) const {
     return ::bbox_intersect(bbox, other->bbox);
 }
 
-bool Occl_Mesh::bbox_intersect(const BBox& other_bbox) {
+bool Occl_Mesh::bbox_intersect(const BBox& other_bbox) const {
     return ::bbox_intersect(bbox, other_bbox);
 }
 
-bool Occl_Mesh::inside(Octree<Occl_Mesh *>& tree) {
-    // Custom implementation of a concrete octree operation.
+static bool hull_contains_strictly(std::span<const glm::vec2> hull, const glm::vec2& p) {
+    for (size_t i = 0; i < hull.size(); i++) {
+        const glm::vec2& curr = hull[i];
+        const glm::vec2& next = hull[(i + 1) % hull.size()];
+
+        if (glm::dot(p - curr, orth(next - curr)) >= 0.0f) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+u64 Occl_Mesh::coverage_mask(const BBox& box) const {
+    constexpr int n = occl_coverage_cells;
+    static_assert(n * n == 64);
+
+    if (!bbox_intersect(box)) {
+        return 0;
+    }
+
+    // A cell is covered if its four corners are, which only grid corners within the bbox can be.
+    glm::vec2 cell = (box.br - box.tl) / (f32)n;
+    int x0 = std::clamp((int)ceilf((bbox.tl.x - box.tl.x) / cell.x), 0, n), x1 = std::clamp((int)floorf((bbox.br.x - box.tl.x) / cell.x), 0, n);
+    int y0 = std::clamp((int)ceilf((bbox.tl.y - box.tl.y) / cell.y), 0, n), y1 = std::clamp((int)floorf((bbox.br.y - box.tl.y) / cell.y), 0, n);
+
+    if (x0 >= x1 || y0 >= y1) {
+        return 0;
+    }
+
+    std::span<const glm::vec2> hull = convex_hull();
+    u16 rows[n + 1] = {}; // Bit x of row y is set if that grid corner is inside.
+
+    for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) {
+            if (hull_contains_strictly(hull, box.tl + glm::vec2((f32)x, (f32)y) * cell)) rows[y] |= 1 << x;
+        }
+    }
+
+    u64 mask = 0;
+    for (int y = y0; y < y1; y++) {
+        u32 corners = rows[y] & rows[y + 1];
+        mask |= (u64)((corners & (corners >> 1)) & 0xff) << (y * n);
+    }
+
+    return mask;
+}
+
+// Cells without coverage are left to the child below them, which is checked once for all of
+// them in its quadrant.
+static bool cells_covered(const Octree<Occl_Mesh *>::Octree_Node *node, const BBox& bbox) {
+    constexpr int n = occl_coverage_cells;
+    const BBox& box = node->bbox;
+    glm::vec2 cell = (box.br - box.tl) / (f32)n;
+
+    int x0 = std::clamp((int)floorf((bbox.tl.x - box.tl.x) / cell.x), 0, n - 1), x1 = std::clamp((int)ceilf((bbox.br.x - box.tl.x) / cell.x) - 1, 0, n - 1);
+    int y0 = std::clamp((int)floorf((bbox.tl.y - box.tl.y) / cell.y), 0, n - 1), y1 = std::clamp((int)ceilf((bbox.br.y - box.tl.y) / cell.y) - 1, 0, n - 1);
+
+    bool uncovered[4] = {};
+    for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) {
+            if (!((node->coverage >> (y * n + x)) & 1)) uncovered[(x >= n / 2) | ((y >= n / 2) << 1)] = true;
+        }
+    }
+
+    for (int q = 0; q < 4; q++) {
+        if (!uncovered[q]) {
+            continue;
+        }
+
+        const Octree<Occl_Mesh *>::Octree_Node *child = node->children[q];
+        if (child == null) {
+            return false;
+        }
+
+        BBox part = {glm::max(bbox.tl, child->bbox.tl), glm::min(bbox.br, child->bbox.br)};
+        if (!cells_covered(child, part)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool Occl_Mesh::inside_masks(const Octree<Occl_Mesh *>& tree) const {
+    const BBox& root = tree.root->bbox;
+
+    // Parts outside the root have no cells to be covered by.
+    if (bbox.tl.x < root.tl.x || bbox.tl.y < root.tl.y || bbox.br.x > root.br.x || bbox.br.y > root.br.y) {
+        return false;
+    }
+
+    return cells_covered(tree.root, bbox);
+}
+
+int occluded_tree_insert(Octree<Occl_Mesh *>& tree, Occl_Mesh *mesh) {
+    using Node = Octree<Occl_Mesh *>::Octree_Node;
+
+    // Dominated occluders add triangles to the slow path but no coverage. Their cells stay
+    // set in the masks, the new occluder covers those anyway.
+    thread_local std::vector<Occl_Mesh *> dominated, overlapping;
+    dominated.clear();
+    overlapping.clear();
+    tree.intersect(mesh, dominated, overlapping);
 
-    std::queue<Octree<Occl_Mesh *>::Octree_Node *> queue;
-    queue.push(tree.root);
+    for (Occl_Mesh *occluder: dominated) {
+        tree.remove(occluder);
+    }
+
+    tree.insert(mesh);
+    tree.grow(mesh->bbox, std::min(occl_coverage_depth, tree.max_depth));
+
+    tree.visit([mesh](const BBox& bbox) { return mesh->bbox_intersect(bbox); }, [&](const Node *n) {
+        Node *node = const_cast<Node *>(n);
+
+        // Nodes without coverage might have been created just now, so they take in the earlier occluders.
+        if (node->coverage != 0) {
+            node->coverage |= mesh->coverage_mask(node->bbox);
+            return true;
+        }
+
+        tree.visit([node](const BBox& bbox) { return bbox_intersect(node->bbox, bbox); }, [&](const Node *other) {
+            for (const Occl_Mesh *occluder: other->upon_line) {
+                node->coverage |= occluder->coverage_mask(node->bbox);
+            }
 
-    std::vector<Octree<Occl_Mesh *>::Octree_Node *> inters;
+            return true;
+        });
+
+        return true;
+    });
+
+    return (int)dominated.size();
+}
 
-    while (queue.size() > 0) {
-        Octree<Occl_Mesh *>::Octree_Node *node = queue.front();
-        queue.pop();
+bool Occl_Mesh::inside(const Octree<Occl_Mesh *>& tree, const Occl_Slow_Path_Params& params,
+                       const std::vector<triangle> *covered, bool *out_of_budget) const {
+    OCCL_TRACE_SCOPE("inside", "hull", (i64)hull_count);
+    using Node = Octree<Occl_Mesh *>::Octree_Node;
+    auto descend = [this](const BBox& bbox) { return this->bbox_intersect(bbox); };
 
-        // Try to resolve using the fast method first.
+    // Reused, so only the first tests on a thread allocate.
+    thread_local std::vector<const Node *> inters;
+    thread_local std::vector<prepared_triangle> inters_tris;
+    inters.clear();
+
+    // Try to resolve using the fast method first, any single containing occluder ends the search.
+    bool contained = !tree.visit(descend, [this](const Node *node) {
         for (const Occl_Mesh *upon: node->upon_line) {
             if (this->inside_fast(upon)) {
-                return true;
+                return false;
             }
         }
 
         inters.push_back(node);
+        return true;
+    });
 
-        for (int i = 0; i < 2; i++) {
-            for (int j = 0; j < 2; j++) {
-                Octree<Occl_Mesh *>::Octree_Node *child = node->children[i][j];
+    if (contained) {
+        return true;
+    }
 
-                if (child != null && this->bbox_intersect(child->bbox)) {
-                    queue.push(child);
-                }
-            }
-        }
+    if (inside_masks(tree)) {
+        OCCL_STAT_ADD(mask_hits, 1);
+        return true;
     }
 
     // Try the fast method using convexity on the indiviual triangles one last time.
     // Fallback to the slow method, if the fast one fails.
-    std::vector<triangle> inters_tris;
-    for (const Octree<Occl_Mesh *>::Octree_Node *node: inters) {
+    OCCL_STAT_ADD(slow_path_calls, 1);
+    // Prepared once here, every remainder of every triangle below is subtracted from them.
+    inters_tris.clear();
+
+    for (const Node *node: inters) {
         for (const Occl_Mesh *mesh: node->upon_line) {
             if (!this->intersect(mesh)) {
                 continue;
             }
 
-            for (const triangle &tri: mesh->mesh_proj) {
-                inters_tris.push_back(tri);
+            for (const triangle &tri: mesh->mesh_proj()) {
+                inters_tris.push_back(prepare_triangle(tri));
             }
         }
     }
 
-    for (const triangle &tri: mesh_proj) {
-        if (!tri_in_mesh(tri, inters_tris)) {
+    if (covered != null) {
+        for (const triangle &tri: *covered) {
+            inters_tris.push_back(prepare_triangle(tri));
+        }
+    }
+
+    // One budget for the whole mesh, so its latency is bounded and not just per triangle.
+    Occl_Work_Budget budget(params.max_subtractions, params.max_cycles);
+
+    for (const triangle &tri: mesh_proj()) {
+        if (!tri_in_mesh(tri, inters_tris, params.min_rem_area, &budget)) {
+            if (out_of_budget != null) *out_of_budget = budget.exhausted;
             return false;
         }
     }
@@ -1056,74 +1715,657 @@ bool Occl_Mesh::inside(Octree<Occl_Mesh *>& tree) {
     return true;
 }
 
-Occl_Cull_Context::Occl_Cull_Context(size_t reserve, const BBox& clip_box)
-    : draw_tree_alloc(1024 * 512), occl_tree_alloc(1024 * 512), draw_tree(&draw_tree_alloc, clip_box), occluded_tree(&occl_tree_alloc, clip_box),
-        reserved(reserve), total_occluded(0), total_fast(0), total_slow(0) {
-
-    meshes.reserve(reserve); // TODO: Workaround so pointers stay valid!
-    flags.reserve(reserve);
+Occl_Cull_View::Occl_Cull_View(const Occl_Cull_Context *ctx, f32 looseness)
+    : ctx(ctx), occl_tree_alloc(1024 * 512),
+        occluded_tree(&occl_tree_alloc, ctx->draw_tree.root->bbox, looseness), stats{}, temporal(false), unconfirmed_seeds(0),
+        occluder_budget(0), selection_active(false), incremental(false), incremental_frame(false),
+        dirty_seen(ctx->dirty_base + ctx->dirty_regions.size()) {
+
+    flags.reserve(ctx->reserved);
+    hidden.reserve(ctx->reserved);
+    costs.reserve(ctx->reserved);
+    seeds.reserve(ctx->reserved);
+    selected.reserve(ctx->reserved);
+    flags.assign(ctx->meshes.size());
+    hidden.assign(ctx->meshes.size());
+    costs.resize(ctx->meshes.size(), {});
+    seeds.resize(ctx->meshes.size(), 0);
+    selected.resize(ctx->meshes.size(), 0);
 }
 
-void Occl_Cull_Context::add_mesh(const Occl_Mesh&& mesh) {
-    flags.push_back(0);
-    meshes.push_back(mesh);
+void Occl_Cull_View::begin_frame() {
+    OCCL_TRACE_SCOPE("begin_frame");
+    incremental_frame = incremental && !temporal && begin_incremental_frame();
+    dirty_seen = ctx->dirty_base + ctx->dirty_regions.size();
+
+    if (incremental_frame) {
+        return;
+    }
+
+    // Only occluders the caller submitted last frame seed this one.
+    last_occluders.clear();
+    for (int i: occluders) {
+        if (seeds[i] != SEED_UNCONFIRMED) last_occluders.push_back(i);
+    }
 
-    assert(meshes.size() <= reserved); // TODO: Make memory move impossible.
+    std::swap(hidden, last_hidden);
+    flags.assign(ctx->meshes.size());
+    hidden.assign(ctx->meshes.size());
+    costs.assign(ctx->meshes.size(), Occl_Mesh_Cost{});
+    seeds.assign(ctx->meshes.size(), 0);
+    selected.assign(ctx->meshes.size(), 0);
+    selection_active = false;
+    occluders.clear();
+    rejected.clear();
+    unconfirmed_seeds = 0;
+    occluded_tree.clear();
+
+    if (!temporal) {
+        return;
+    }
 
-    draw_tree.insert(&meshes[meshes.size() - 1]);
+    // First pass: cull against last frame's occluders before anything is submitted.
+    Occl_Stats_Scope stats_scope(&stats);
+
+    for (int i: last_occluders) {
+        // The sector of a seed might have been unloaded since.
+        if (i >= (int)flags.size() || flags.get(i) != 0 || ctx->mesh_sectors[i] < 0) continue;
+
+        seeds[i] = SEED_UNCONFIRMED;
+        unconfirmed_seeds++;
+        stats.total_seeded++;
+
+        Occl_Phase_Clock clock;
+        insert_occluder(i, clock);
+    }
 }
 
-void Occl_Cull_Context::flag_mesh(int index, Occl_Cull_Flag flag) {
-    flags[index] |= (u8)flag;
+bool Occl_Cull_View::begin_incremental_frame() {
+    if (dirty_seen < ctx->dirty_base) {
+        return false;
+    }
 
-    if (flag == Occl_Cull_Flag::OCCLUDED) {
-        Occl_Mesh& occl_mesh = meshes[index];
+    Occl_Stats_Scope stats_scope(&stats);
+    const std::vector<Occl_Mesh>& meshes = ctx->meshes;
+    size_t old_count = flags.size();
 
-        if (occl_mesh.inside(occluded_tree)) {
-            return;
+    last_hidden = hidden;
+    dirty.assign(meshes.size());
+
+    // Meshes new to this view have nothing to keep.
+    for (size_t i = old_count; i < meshes.size(); i++) {
+        flags.push_back();
+        hidden.push_back(false);
+        dirty.set(i);
+    }
+
+    auto mark = [&](const BBox& region, bool hidden_only) {
+        ctx->draw_tree.visit([&](const BBox& bbox) { return bbox_intersect(bbox, region); }, [&](const Octree<Occl_Mesh *>::Octree_Node *node) {
+            for (const Occl_Mesh *mesh: node->upon_line) {
+                int i = mesh - meshes.data();
+                if (mesh->bbox_intersect(region) && (!hidden_only || hidden.get(i))) dirty.set(i);
+            }
+
+            return true;
+        });
+    };
+
+    // Occluders are dropped if they changed or the caller marked them dirty. The others keep their
+    // flags even inside a dirty region, the new occluders there cannot make them less of an occluder.
+    Occl_Bitset dropped;
+    dropped.assign(meshes.size());
+
+    for (size_t r = dirty_seen - ctx->dirty_base; r < ctx->dirty_regions.size(); r++) {
+        const Occl_Dirty_Region& region = ctx->dirty_regions[r];
+        mark(region.bbox, false);
+
+        if (region.index >= 0) {
+            dropped.set(region.index);
+            continue;
         }
-            
-        occluded_tree.insert(&occl_mesh); // TODO: This might be wrong because of pointer to ref.!
 
-        std::vector<Occl_Mesh *> inside_meshes;
-        std::vector<Occl_Mesh *> affected_meshes;
-        draw_tree.intersect(&occl_mesh, inside_meshes, affected_meshes);
-        total_occluded++;
+        for (int i: occluders) {
+            if (meshes[i].bbox_intersect(region.bbox)) dropped.set(i);
+        }
+    }
+
+    // Unloaded slots are in no tree, their old bbox is dirty but they have to be found here.
+    for (size_t i = 0; i < old_count; i++) {
+        if (ctx->mesh_sectors[i] < 0) dirty.set(i);
+    }
+
+    // Whatever a dropped occluder hid is re-tested as well. Those were hidden, so they were no
+    // occluders themselves and this does not cascade any further.
+    for (int i: occluders) {
+        if (dropped.get(i)) {
+            mark(meshes[i].bbox, true);
+        } else {
+            dirty.unset(i);
+        }
+    }
+
+    int cached = 0;
+    for (size_t w = 0; w < dirty.words.size(); w++) {
+        u64 keep = ~dirty.words[w];
+        flags.drawn.words[w] &= keep;
+        flags.occluded.words[w] &= keep;
+        hidden.words[w] &= keep;
+        cached += std::popcount(flags.drawn.words[w] | flags.occluded.words[w]);
+    }
+
+    costs.assign(meshes.size(), Occl_Mesh_Cost{});
+    seeds.assign(meshes.size(), 0);
+    selected.assign(meshes.size(), 0);
+    selection_active = false;
+    rejected.clear();
+    unconfirmed_seeds = 0;
+    stats.total_cached += cached;
+
+    // Kept occluders stay in their old order. The tree is rebuilt since updated meshes moved.
+    std::erase_if(occluders, [&](int i) { return dropped.get(i); });
+    occluded_tree.clear();
+
+    for (int i: occluders) {
+        occluded_tree_insert(occluded_tree, const_cast<Occl_Mesh *>(&meshes[i]));
+    }
+
+    // Kept occluders are not inserted again, so they would not reject the cleared meshes behind them.
+    // Same as insert_occluder does, minus the insertion.
+    std::vector<Occl_Mesh *>& inside_meshes = inside_scratch;
+    std::vector<Occl_Mesh *>& affected_meshes = affected_scratch;
+
+    for (int o: occluders) {
+        inside_meshes.clear();
+        affected_meshes.clear();
+        ctx->draw_tree.intersect(const_cast<Occl_Mesh *>(&meshes[o]), inside_meshes, affected_meshes);
 
-        // TODO: Duplicate code.
         for (Occl_Mesh *mesh: inside_meshes) {
             int i = mesh - meshes.data();
-            assert(i >= 0 && i < (int)meshes.size()); // TODO: Make sure memory can't move!
-
-            if (flags[i] != 0) continue;
+            if (!dirty.get(i) || flags.get(i) != 0) continue;
 
-            flags[i] |= (u8)Occl_Cull_Flag::OCCLUDED;
-            total_fast++;
+            reject(i);
+            stats.total_fast++;
         }
 
-        for (Occl_Mesh *mesh: affected_meshes) { 
+        for (Occl_Mesh *mesh: affected_meshes) {
             int i = mesh - meshes.data();
-            assert(i >= 0 && i < (int)meshes.size()); // TODO: Make sure memory can't move!
-            
-            if (flags[i] != 0) continue;
+            if (!dirty.get(i) || flags.get(i) != 0) continue;
 
-            if (mesh->inside(occluded_tree)) {
-                flags[i] |= (u8)Occl_Cull_Flag::OCCLUDED;
-                total_slow++;
+            if (test_occluded(i)) {
+                reject(i);
+                stats.total_slow++;
             }
         }
     }
+
+    return true;
+}
+
+void Occl_Cull_View::end_frame() {
+    OCCL_TRACE_SCOPE("end_frame", "unconfirmed_seeds", unconfirmed_seeds);
+    if (unconfirmed_seeds == 0) {
+        return;
+    }
+
+    // Second pass: some seeds were not submitted this frame, so they must not occlude anything.
+    // Rebuild the tree without them and re-check only what got rejected while they were in it.
+    Occl_Stats_Scope stats_scope(&stats);
+    occluded_tree.clear();
+
+    for (int i: occluders) {
+        if (seeds[i] != SEED_UNCONFIRMED) {
+            occluded_tree_insert(occluded_tree, const_cast<Occl_Mesh *>(&ctx->meshes[i]));
+        }
+    }
+
+    // Cleared first, so the revived occluders below don't append to rejected.
+    unconfirmed_seeds = 0;
+    Occl_Phase_Clock clock;
+
+    for (auto [i, submitted]: rejected) {
+        bool out_of_budget = false;
+        if (test_occluded(i, &out_of_budget)) {
+            continue;
+        }
+
+        // Meshes the caller submitted after they got rejected are in here twice.
+        if (hidden.get(i)) {
+            hidden.unset(i);
+            stats.total_revived++;
+        }
+
+        if (!submitted) {
+            flags.unset(i, Occl_Cull_Flag::OCCLUDED);
+            continue;
+        }
+
+        // Caller submitted occluders get in, as flag_mesh would have done without the stale seeds.
+        flags.set(i, Occl_Cull_Flag::OCCLUDED);
+        if (!out_of_budget && (!selection_active || selected[i])) {
+            insert_occluder(i, clock);
+        }
+    }
+
+    rejected.clear();
+}
+
+f32 Occl_Cull_View::occluder_score(int index) const {
+    const Occl_Mesh& mesh = ctx->meshes[index];
+    std::span<const glm::vec2> hull = mesh.convex_hull();
+
+    // Shoelace formula, so scoring does not triangulate the candidates.
+    f32 area = 0.0f, perimeter = 0.0f;
+    for (size_t i = 0; i < hull.size(); i++) {
+        const glm::vec2& curr = hull[i];
+        const glm::vec2& next = hull[(i + 1) % hull.size()];
+
+        area += 0.5f * (curr.x * next.y - next.x * curr.y);
+        perimeter += glm::length(next - curr);
+    }
+
+    if (perimeter <= 0.0f) {
+        return 0.0f;
+    }
+
+    // 1 for a disk, slivers go towards 0.
+    f32 compactness = 4.0f * (f32)M_PI * area / (perimeter * perimeter);
+
+    // Counts the candidate itself as well, whether or not inside_fast finds it inside itself.
+    size_t hidden = 1;
+    ctx->draw_tree.visit([&](const BBox& bbox) { return mesh.bbox_intersect(bbox); }, [&](const Octree<Occl_Mesh *>::Octree_Node *node) {
+        for (const Occl_Mesh *other: node->upon_line) {
+            hidden += other != &mesh && other->intersect(&mesh) && other->inside_fast(&mesh);
+        }
+
+        return true;
+    });
+
+    return area * compactness * (f32)hidden;
+}
+
+void Occl_Cull_View::select_occluders(const std::vector<int>& candidates) {
+    OCCL_TRACE_SCOPE("select_occluders", "candidates", (i64)candidates.size());
+    if (occluder_budget <= 0) {
+        return;
+    }
+
+    std::vector<std::pair<f32, int>> scored;
+    scored.reserve(candidates.size());
+    for (int i: candidates) {
+        scored.push_back({occluder_score(i), i});
+    }
+
+    size_t count = std::min(scored.size(), (size_t)occluder_budget);
+    std::partial_sort(scored.begin(), scored.begin() + count, scored.end(), [](const auto& a, const auto& b) {
+        return a.first > b.first;
+    });
+
+    for (size_t k = 0; k < count; k++) {
+        selected[scored[k].second] = 1;
+    }
+
+    selection_active = true;
+}
+
+bool Occl_Cull_View::test_occluded(int index, bool *out_of_budget) {
+#if OCCL_STATS
+    u64 subtractions = stats.subtract_calls;
+    u64 start = occl_read_cycles();
+#endif
+
+    bool occluded = ctx->meshes[index].inside(occluded_tree, ctx->slow_path, null, out_of_budget);
+
+#if OCCL_STATS
+    Occl_Mesh_Cost& cost = costs[index];
+    cost.slow_tests++;
+    cost.subtractions += stats.subtract_calls - subtractions;
+    cost.cycles += occl_read_cycles() - start;
+#endif
+
+    return occluded;
+}
+
+void Occl_Cull_View::reject(int index, bool submitted) {
+    flags.set(index, Occl_Cull_Flag::OCCLUDED);
+    hidden.set(index);
+    if (unconfirmed_seeds > 0) rejected.push_back({index, submitted});
+}
+
+void Occl_Cull_View::insert_occluder(int index, Occl_Phase_Clock& clock) {
+    const std::vector<Occl_Mesh>& meshes = ctx->meshes;
+    // The trees only store non-const pointers, the payloads are never written to though.
+    Occl_Mesh *occl_mesh = const_cast<Occl_Mesh *>(&meshes[index]);
+
+    // Evicted occluders stay in the list, end_frame needs them if they were inside a seed.
+    stats.total_evicted += occluded_tree_insert(occluded_tree, occl_mesh);
+    occluders.push_back(index);
+    clock.lap(Occl_Phase::OCCLUDER_INSERT);
+
+    std::vector<Occl_Mesh *>& inside_meshes = inside_scratch;
+    std::vector<Occl_Mesh *>& affected_meshes = affected_scratch;
+    inside_meshes.clear();
+    affected_meshes.clear();
+    ctx->draw_tree.intersect(occl_mesh, inside_meshes, affected_meshes);
+    stats.total_occluded++;
+    clock.lap(Occl_Phase::DRAW_QUERY);
+
+    // TODO: Duplicate code.
+    for (Occl_Mesh *mesh: inside_meshes) {
+        int i = mesh - meshes.data();
+        assert(i >= 0 && i < (int)meshes.size()); // TODO: Make sure memory can't move!
+
+        if (i >= (int)flags.size() || flags.get(i) != 0 || seeds[i] != 0) continue;
+
+        reject(i);
+        stats.total_fast++;
+    }
+
+    clock.lap(Occl_Phase::FAST_FLAG);
+
+    for (Occl_Mesh *mesh: affected_meshes) { 
+        int i = mesh - meshes.data();
+        assert(i >= 0 && i < (int)meshes.size()); // TODO: Make sure memory can't move!
+        
+        if (i >= (int)flags.size() || flags.get(i) != 0 || seeds[i] != 0) continue;
+
+        if (test_occluded(i)) {
+            reject(i);
+            stats.total_slow++;
+        }
+    }
+
+    clock.lap(Occl_Phase::SLOW_FLAG);
+}
+
+void Occl_Cull_View::flag_mesh(int index, Occl_Cull_Flag flag) {
+    assert(index >= 0 && index < (int)flags.size()); // Meshes added since the last begin_frame are unknown.
+
+    OCCL_TRACE_SCOPE("flag_mesh", "mesh", index);
+
+    // Kept from the last frame.
+    if (incremental_frame && !dirty.get(index) && flags.get(index) != 0) {
+        return;
+    }
+
+    Occl_Stats_Scope stats_scope(&stats);
+    OCCL_STAT_ADD(flag_calls, 1);
+    flags.set(index, flag);
+
+    if (flag == Occl_Cull_Flag::OCCLUDED) {
+        // Seeds are already in the tree, the caller only confirms them.
+        if (seeds[index] == SEED_UNCONFIRMED) {
+            seeds[index] = SEED_CONFIRMED;
+            unconfirmed_seeds--;
+            return;
+        }
+
+        Occl_Phase_Clock clock;
+
+        bool out_of_budget = false;
+        bool occluded = test_occluded(index, &out_of_budget);
+        clock.lap(Occl_Phase::SELF_TEST);
+
+        if (occluded) {
+            reject(index, true);
+            return;
+        }
+
+        // It is most likely almost covered, so it would add a lot of triangles but hardly any coverage.
+        if (out_of_budget) {
+            return;
+        }
+
+        if (selection_active && !selected[index]) {
+            stats.total_unselected++;
+            return;
+        }
+
+        insert_occluder(index, clock);
+    }
+}
+
+u8 Occl_Cull_View::get_flags(int index) {
+    return flags.get(index);
+}
+
+void Occl_Cull_View::flagged_indices(Occl_Cull_Flag flag, std::vector<int>& indices) const {
+    flags.bits(flag).compact(indices);
+}
+
+void Occl_Cull_View::hidden_indices(std::vector<int>& indices) const {
+    hidden.compact(indices);
+}
+
+void Occl_Cull_View::frame_diff(std::vector<int>& newly_visible, std::vector<int>& newly_hidden) const {
+    // A word at a time, most words of a coherent frame do not change at all.
+    for (size_t w = 0; w < hidden.words.size(); w++) {
+        u64 now = hidden.words[w];
+        u64 last = (w < last_hidden.words.size()) ? last_hidden.words[w] : 0;
+
+        for (u64 bits = last & ~now; bits != 0; bits &= bits - 1) {
+            newly_visible.push_back((int)(w * 64 + std::countr_zero(bits)));
+        }
+
+        for (u64 bits = now & ~last; bits != 0; bits &= bits - 1) {
+            newly_hidden.push_back((int)(w * 64 + std::countr_zero(bits)));
+        }
+    }
+}
+
+Occl_Cull_Context::Occl_Cull_Context(size_t reserve, const BBox& clip_box, f32 looseness)
+    : draw_tree_alloc(1024 * 512), draw_tree(&draw_tree_alloc, clip_box, looseness),
+        reserved(reserve), dirty_base(0), view(this, looseness), capture(null) {
+    draw_tree.leaf_capacity = 8; // Most draw meshes are small, buckets keep them out of deep chains.
+
+    meshes.reserve(reserve); // TODO: Workaround so pointers stay valid!
+    mesh_sectors.reserve(reserve);
+    pool.reserve(reserve);
+}
+
+Occl_Cull_Context::~Occl_Cull_Context() {
+    stop_capture();
+}
+
+bool Occl_Cull_Context::start_capture(const char *path) {
+    stop_capture();
+
+    FILE *file = fopen(path, "wb");
+    if (file == null) {
+        print_error("Failed to open capture '%s' for writing.\n", path);
+        return false;
+    }
+
+    capture = new Occl_Capture_Writer(file, draw_tree.root->bbox, reserved);
+
+    // Free slots become placeholders that are unloaded right away, so a replay
+    // hands out the same slots to later meshes.
+    for (size_t i = 0; i < meshes.size(); i++) {
+        bool free = mesh_sectors[i] < 0;
+        capture->add_mesh(free ? std::span<const glm::vec2>() : meshes[i].convex_hull(), free ? occl_capture_free_sector : mesh_sectors[i]);
+    }
+
+    if (!free_slots.empty()) {
+        capture->unload_sector(occl_capture_free_sector);
+    }
+
+    return true;
+}
+
+void Occl_Cull_Context::stop_capture() {
+    delete capture;
+    capture = null;
+}
+
+int Occl_Cull_Context::add_mesh(std::span<const glm::vec2> convex_hull, int sector) {
+    assert(sector >= 0 || (capture == null && sector == occl_capture_free_sector));
+    if (capture != null) capture->add_mesh(convex_hull, sector);
+
+    int index;
+
+    if (!free_slots.empty()) {
+        std::pop_heap(free_slots.begin(), free_slots.end(), std::greater<int>());
+        index = free_slots.back();
+        free_slots.pop_back();
+
+        meshes[index] = pool.add(convex_hull);
+        mesh_sectors[index] = sector;
+
+        // Forget what the default view knew about the last mesh in this slot.
+        view.flags.unset(index, Occl_Cull_Flag::DRAWN);
+        view.flags.unset(index, Occl_Cull_Flag::OCCLUDED);
+        view.hidden.unset(index);
+        if (index < (int)view.last_hidden.size()) view.last_hidden.unset(index);
+        view.costs[index] = {};
+        view.seeds[index] = 0;
+        view.selected[index] = 0;
+    } else {
+        meshes.push_back(pool.add(convex_hull));
+        mesh_sectors.push_back(sector);
+        index = (int)meshes.size() - 1;
+
+        assert(meshes.size() <= reserved); // TODO: Make memory move impossible.
+
+        // The default view can be used without starting a frame first.
+        view.flags.push_back();
+        view.hidden.push_back(false);
+        view.costs.push_back({});
+        view.seeds.push_back(0);
+        view.selected.push_back(0);
+    }
+
+    // Empty meshes hide nothing and are never hidden, only captures use them as placeholders.
+    if (meshes[index].hull_count > 0) {
+        draw_tree.insert(&meshes[index]);
+        add_dirty(meshes[index].bbox, index);
+    }
+
+    return index;
+}
+
+void Occl_Cull_Context::unload_sector(int sector) {
+    if (capture != null) capture->unload_sector(sector);
+
+    for (size_t i = 0; i < meshes.size(); i++) {
+        if (mesh_sectors[i] != sector) continue;
+
+        Occl_Mesh& mesh = meshes[i];
+        if (mesh.hull_count > 0) {
+            draw_tree.remove(&mesh);
+            add_dirty(mesh.bbox, (int)i);
+        }
+
+        pool.remove(mesh);
+
+        mesh.hull_offset = mesh.hull_count = mesh.tri_count = 0;
+        mesh_sectors[i] = -1;
+
+        free_slots.push_back((int)i);
+        std::push_heap(free_slots.begin(), free_slots.end(), std::greater<int>());
+    }
+
+    // Merges what the removals left sparse back into leaf buckets.
+    draw_tree.collapse();
+
+    // Only once most of the pool is dead, so the copying is amortized over the unloads.
+    if (pool.dead_pts * 2 > pool.pts.size()) {
+        pool.compact(meshes);
+    }
+}
+
+void Occl_Cull_Context::update_mesh(int index, std::span<const glm::vec2> convex_hull) {
+    assert(index >= 0 && index < (int)meshes.size() && mesh_sectors[index] >= 0);
+    if (capture != null) capture->update_mesh(index, convex_hull);
+
+    Occl_Mesh& mesh = meshes[index];
+    if (mesh.hull_count > 0) {
+        draw_tree.remove(&mesh);
+        add_dirty(mesh.bbox, index);
+    }
+
+    pool.remove(mesh);
+    mesh = pool.add(convex_hull);
+
+    if (mesh.hull_count > 0) {
+        draw_tree.insert(&mesh);
+        add_dirty(mesh.bbox, index);
+    }
+
+    if (pool.dead_pts * 2 > pool.pts.size()) {
+        pool.compact(meshes);
+    }
+}
+
+void Occl_Cull_Context::mark_dirty(const BBox& bbox) {
+    if (capture != null) capture->mark_dirty(bbox);
+    add_dirty(bbox);
+}
+
+void Occl_Cull_Context::add_dirty(const BBox& bbox, int index) {
+    if (dirty_regions.size() >= max_dirty_regions) {
+        dirty_base += dirty_regions.size();
+        dirty_regions.clear();
+    }
+
+    dirty_regions.push_back({bbox, index});
+}
+
+void Occl_Cull_Context::begin_frame() {
+    if (capture != null) capture->begin_frame();
+
+    // Drop what the default view applied last frame. Views that begin their frames after it
+    // have applied those as well, any other view culls its next frame in full.
+    if (view.dirty_seen > dirty_base) {
+        dirty_regions.erase(dirty_regions.begin(), dirty_regions.begin() + (view.dirty_seen - dirty_base));
+        dirty_base = view.dirty_seen;
+    }
+
+    view.begin_frame();
+}
+
+void Occl_Cull_Context::end_frame() {
+    if (capture != null) capture->end_frame();
+    view.end_frame();
+}
+
+void Occl_Cull_Context::select_occluders(const std::vector<int>& candidates) {
+    if (capture != null) capture->select_occluders(view.occluder_budget, candidates);
+    view.select_occluders(candidates);
+}
+
+void Occl_Cull_Context::flag_mesh(int index, Occl_Cull_Flag flag) {
+    if (capture != null) capture->flag_mesh(index, flag);
+    view.flag_mesh(index, flag);
 }
 
 u8 Occl_Cull_Context::get_flags(int index) {
-    return flags[index];
+    return view.get_flags(index);
+}
+
+void Occl_Cull_Context::flagged_indices(Occl_Cull_Flag flag, std::vector<int>& indices) const {
+    view.flagged_indices(flag, indices);
+}
+
+void Occl_Cull_Context::hidden_indices(std::vector<int>& indices) const {
+    view.hidden_indices(indices);
+}
+
+void Occl_Cull_Context::frame_diff(std::vector<int>& newly_visible, std::vector<int>& newly_hidden) const {
+    view.frame_diff(newly_visible, newly_hidden);
+}
+
+Occl_Cull_Stats Occl_Cull_Context::snapshot_stats() const {
+    return view.stats;
+}
+
+void Occl_Cull_Context::reset_stats() {
+    view.stats.reset();
 }
 
 size_t Occl_Cull_Context::get_total_tri_count() {
     size_t total_tris = 0;
 
     for (size_t i = 0; i < meshes.size(); i++) {        
-        total_tris += meshes[i].mesh_proj.size();
+        total_tris += meshes[i].tri_count;
     }
 
     return total_tris;
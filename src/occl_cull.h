@@ -1,119 +1,418 @@
 #pragma once
 #include "util.h"
 #include "memory.h"
+#include "occl_stats.h"
 #include <vector>
+#include <algorithm>
 #include <concepts>
 #include <utility>
-#include <queue>
+#include <span>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <memory>
 #include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
 
-struct BBox {
-    glm::vec2 tl;
-    glm::vec2 br;
+template<int D>
+struct BBox_T {
+    glm::vec<D, f32> tl;
+    glm::vec<D, f32> br;
 
-    inline glm::vec2 middle() const {
+    inline glm::vec<D, f32> middle() const {
         return 0.5f * (tl + br);
     }
 };
 
-template<typename T>
-concept Octree_Data = requires(f32 v, T a, T b, BBox bbox, f32 t, uint dim) {
+using BBox = BBox_T<2>;
+using AABB = BBox_T<3>;
+
+template<int D>
+inline bool bbox_intersect(const BBox_T<D>& a, const BBox_T<D>& b) {
+    for (int d = 0; d < D; d++) {
+        if (b.tl[d] > a.br[d] || b.br[d] < a.tl[d]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+template<typename T, int D>
+concept Octree_Data = requires(f32 v, T a, T b, BBox_T<D> bbox, f32 t, uint dim) {
     { a->compare(v, dim) } -> std::convertible_to<int>;
     { a->inside_fast(b) } -> std::same_as<bool>;
     { a->intersect(b) } -> std::same_as<bool>;
     { a->bbox_intersect(bbox) } -> std::same_as<bool>;
 };
 
-template<typename T>
+// A quadtree for D == 2 and an octree for D == 3. Bit d of a child index is set
+// if the child covers the upper half of its parent in dimension d.
+template<typename T, int D = 2>
 class Octree {
 public: // TODO: Revert!
-    static_assert(Octree_Data<T>);
+    static_assert(Octree_Data<T, D>);
+    static constexpr int child_count = 1 << D;
+    // Upper bound of max_depth, so traversals can use a fixed size stack.
+    static constexpr int depth_limit = 32;
+
+    using vec = glm::vec<D, f32>;
+    using bbox_type = BBox_T<D>;
 
     struct Octree_Node {
-        BBox bbox;
+        bbox_type bbox;
+        bbox_type loose_bbox; // Bounds of everything stored in this subtree, queries must test against this one.
         std::vector<T> upon_line;
-        Octree_Node *children[2][2];
+        Octree_Node *children[child_count];
+        u64 coverage; // 0 for new nodes, then up to the user of the tree. Not touched by remove.
     };
 
     bump_allocator *allocator;
     Octree_Node *root;
+    Octree_Node *free_nodes; // Emptied by remove, linked through children[0].
+
+    // Children are enlarged by looseness times their size on every side, so payloads
+    // near a midpoint still descend. 0 gives the classic tight tree.
+    f32 looseness;
+
+    // Nodes at max_depth keep everything. Leaves keep up to leaf_capacity payloads
+    // that would fit into a child before they split, 0 splits right away.
+    int max_depth;
+    size_t leaf_capacity;
 
 public:
-    Octree(bump_allocator *allocator, BBox root_bbox) : allocator(allocator) {
+    Octree(bump_allocator *allocator, bbox_type root_bbox, f32 looseness = 0.0f)
+        : allocator(allocator), free_nodes(null), looseness(looseness), max_depth(depth_limit), leaf_capacity(0) {
+        assert(looseness >= 0.0f);
         root = (Octree_Node *)allocator->allocate(sizeof(Octree_Node));
-        new (root) Octree_Node{root_bbox, {}, {}};
+        new (root) Octree_Node{root_bbox, root_bbox, {}, {}, 0};
     }
 
     void insert(const T t) {
         assert(t->bbox_intersect(root->bbox));
+        assert(max_depth >= 0 && max_depth <= depth_limit);
 
-        Octree_Node *parent = null;
-        Octree_Node **node = &root;
+        insert(root, 0, t);
+    }
 
-        for (;;) {
-            int indices[2] = {};
+    // Follows the path insert took for t. Nodes left without payloads and children
+    // go to a free list, which insert takes from before the allocator.
+    bool remove(const T t) {
+        Octree_Node *path[depth_limit + 1];
+        int index = 0;
+        int depth = 0;
+        path[0] = root;
 
-            while (*node != null) {
-                glm::vec2 middle = (*node)->bbox.middle();
-                int compares[2] = {t->compare(middle.x, 0), t->compare(middle.y, 1)};
+        // A leaf bucket might hold t above the node it would descend to.
+        std::vector<T> *upon_line;
+        typename std::vector<T>::iterator it;
 
-                if (compares[0] == 0 || compares[1] == 0) {
-                    (*node)->upon_line.push_back(t);
-                    return;
-                }
+        for (;;) {
+            upon_line = &path[depth]->upon_line;
+            it = std::find(upon_line->begin(), upon_line->end(), t);
+            if (it != upon_line->end()) {
+                break;
+            }
 
-                parent = *node;
-                indices[0] = compares[0] >= 0;
-                indices[1] = compares[1] >= 0;
-                node = &(*node)->children[indices[0]][indices[1]];
+            if (depth >= max_depth || !child_index(path[depth], t, index) || path[depth]->children[index] == null) {
+                return false;
             }
 
-            // Compute new bounding box and create new node.
-            const BBox& p_bbox = parent->bbox;
-            glm::vec2 middle = p_bbox.middle();
-            
-            BBox bbox;
-            switch ((indices[0] << 4) | indices[1]) {
-                case (0 << 4) | 0: bbox = {p_bbox.tl, middle}; break;
-                case (1 << 4) | 0: bbox = {{middle.x, p_bbox.tl.y}, {p_bbox.br.x, middle.y}}; break;
-                case (0 << 4) | 1: bbox = {{p_bbox.tl.x, middle.y}, {middle.x, p_bbox.br.y}}; break;
-                case (1 << 4) | 1: bbox = {middle, p_bbox.br}; break;
+            path[depth + 1] = path[depth]->children[index];
+            depth++;
+        }
+
+        *it = upon_line->back();
+        upon_line->pop_back();
+
+        for (; depth > 0; depth--) {
+            Octree_Node *node = path[depth];
+            if (!node->upon_line.empty() || !is_leaf(node)) {
+                break;
             }
 
-            // TODO: Speed. Allocating all children upfront might be a good idea for intersection speed.
-            *node = (Octree_Node *)allocator->allocate(sizeof(Octree_Node));
-            new (*node) Octree_Node{bbox, {}, {}};
+            Octree_Node *parent = path[depth - 1];
+            *std::find(parent->children, parent->children + child_count, node) = null;
+            free_node(node);
         }
+
+        return true;
     }
 
-    void intersect(const T t, std::vector<T>& insides, std::vector<T>& inters) {
-        assert(t->bbox_intersect(root->bbox));
+    // Pulls every subtree holding at most leaf_capacity payloads up into its root, so
+    // the chains of single children left behind by small payloads become leaf buckets.
+    void collapse() {
+        collapse(root);
+    }
+
+    // Creates the missing nodes down to depth whose bbox intersects the given one. They
+    // hold no payloads, so remove frees them again once it passes by.
+    void grow(const bbox_type& bbox, int depth) {
+        assert(depth >= 0 && depth <= max_depth);
+        grow(root, bbox, depth);
+    }
+
+    // Calls f(node, depth) for every node in depth-first order.
+    template<typename F>
+    void for_each_node(F&& f) const {
+        for_each_node(root, 0, f);
+    }
 
-        std::queue<Octree_Node *> queue;
-        queue.push(root);
+    // Destroys all nodes and resets the allocator, which must not be shared with other trees.
+    void clear() {
+        bbox_type root_bbox = root->bbox;
+        destroy(root);
+        allocator->reset();
+        free_nodes = null;
+
+        root = (Octree_Node *)allocator->allocate(sizeof(Octree_Node));
+        new (root) Octree_Node{root_bbox, root_bbox, {}, {}, 0};
+    }
 
-        while (queue.size() > 0) {
-            Octree_Node *node = queue.front();
-            queue.pop();
+    // Visits the root and every node whose loose bbox passes descend(bbox), depth first and
+    // without allocating. Stops as soon as visit(node) returns false and returns false then.
+    template<typename P, typename V>
+    bool visit(P&& descend, V&& visit) const {
+        const Octree_Node *stack[depth_limit * (child_count - 1) + 1];
+        int size = 0;
+        stack[size++] = root;
 
+        while (size > 0) {
+            const Octree_Node *node = stack[--size];
+            OCCL_STAT_ADD(nodes_visited, 1);
+
+            if (!visit(node)) {
+                return false;
+            }
+
+            for (int i = 0; i < child_count; i++) {
+                const Octree_Node *child = node->children[i];
+
+                if (child != null && descend(child->loose_bbox)) {
+                    stack[size++] = child;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    void intersect(const T t, std::vector<T>& insides, std::vector<T>& inters) const {
+        assert(t->bbox_intersect(root->bbox));
+
+        visit([&](const bbox_type& bbox) { return t->bbox_intersect(bbox); }, [&](const Octree_Node *node) {
             for (const T& upon: node->upon_line) {
+                // Containment implies intersection, so the cheap test goes first.
+                if (!upon->intersect(t)) {
+                    continue;
+                }
+
                 if (upon->inside_fast(t)) {
                     insides.push_back(upon);
-                } else if (upon->intersect(t)) {
+                } else {
                     inters.push_back(upon);
                 }
             }
 
-            for (int i = 0; i < 2; i++) {
-                for (int j = 0; j < 2; j++) {
-                    Octree_Node *child = node->children[i][j];
+            return true;
+        });
+    }
 
-                    if (child != null && t->bbox_intersect(child->bbox)) {
-                        queue.push(child);
+private:
+    // Returns false if t has to stay in node because it fits into none of the children.
+    bool child_index(const Octree_Node *node, const T& t, int& index) const {
+        vec middle = node->bbox.middle();
+        index = 0;
+
+        if (looseness == 0.0f) {
+            for (int d = 0; d < D; d++) {
+                int compare = t->compare(middle[d], d);
+
+                if (compare == 0) {
+                    return false;
+                }
+
+                index |= (compare > 0) << d;
+            }
+
+            return true;
+        }
+
+        // Payloads go to the side of the midpoint they lie on, straddlers to whichever
+        // loose child still contains them. The loose bounds overlap, so that may be both.
+        vec pad = 0.5f * looseness * (node->bbox.br - node->bbox.tl);
+
+        for (int d = 0; d < D; d++) {
+            int side = t->compare(middle[d], d);
+            bool fits_low = t->compare(middle[d] + pad[d], d) < 0 && t->compare(node->bbox.tl[d] - pad[d], d) > 0;
+            bool fits_high = t->compare(middle[d] - pad[d], d) > 0 && t->compare(node->bbox.br[d] + pad[d], d) < 0;
+
+            if (side < 0 && fits_low) {
+                continue;
+            } else if (side > 0 && fits_high) {
+                index |= 1 << d;
+            } else if (side == 0 && (fits_low || fits_high)) {
+                index |= (!fits_low) << d;
+            } else {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    template<typename F>
+    void for_each_node(const Octree_Node *node, int depth, F& f) const {
+        f(node, depth);
+
+        for (int i = 0; i < child_count; i++) {
+            if (node->children[i] != null) {
+                for_each_node(node->children[i], depth + 1, f);
+            }
+        }
+    }
+
+    void grow(Octree_Node *node, const bbox_type& bbox, int depth) {
+        if (depth == 0) {
+            return;
+        }
+
+        for (int i = 0; i < child_count; i++) {
+            if (!bbox_intersect(child_bbox(node->bbox, i), bbox)) {
+                continue;
+            }
+
+            if (node->children[i] == null) {
+                node->children[i] = new_node(node->bbox, i);
+            }
+
+            grow(node->children[i], bbox, depth - 1);
+        }
+    }
+
+    static bool is_leaf(const Octree_Node *node) {
+        return std::all_of(node->children, node->children + child_count, [](const Octree_Node *c) { return c == null; });
+    }
+
+    void insert(Octree_Node *node, int depth, const T t) {
+        for (;;) {
+            int index = 0;
+
+            if (depth >= max_depth || !child_index(node, t, index)) {
+                node->upon_line.push_back(t);
+                return;
+            }
+
+            Octree_Node *child = node->children[index];
+
+            if (child == null) {
+                bool leaf = is_leaf(node);
+
+                if (leaf && node->upon_line.size() < leaf_capacity) {
+                    node->upon_line.push_back(t);
+                    return;
+                }
+
+                child = node->children[index] = new_node(node->bbox, index);
+
+                // The bucket is full, so whatever fits into a child moves down now.
+                if (leaf && leaf_capacity > 0) {
+                    std::vector<T> bucket = std::move(node->upon_line);
+                    node->upon_line.clear();
+
+                    for (const T& u: bucket) {
+                        insert(node, depth, u);
                     }
                 }
             }
+
+            node = child;
+            depth++;
+        }
+    }
+
+    static bbox_type child_bbox(const bbox_type& p_bbox, int index) {
+        vec middle = p_bbox.middle();
+
+        bbox_type bbox = p_bbox;
+        for (int d = 0; d < D; d++) {
+            if (index & (1 << d)) {
+                bbox.tl[d] = middle[d];
+            } else {
+                bbox.br[d] = middle[d];
+            }
+        }
+
+        return bbox;
+    }
+
+    Octree_Node *new_node(const bbox_type& p_bbox, int index) {
+        bbox_type bbox = child_bbox(p_bbox, index);
+        vec pad = looseness * (bbox.br - bbox.tl);
+        bbox_type loose_bbox = {bbox.tl - pad, bbox.br + pad};
+
+        // TODO: Speed. Allocating all children upfront might be a good idea for intersection speed.
+        Octree_Node *node;
+        if (free_nodes != null) {
+            node = free_nodes;
+            free_nodes = free_nodes->children[0];
+        } else {
+            node = (Octree_Node *)allocator->allocate(sizeof(Octree_Node));
+        }
+
+        new (node) Octree_Node{bbox, loose_bbox, {}, {}, 0};
+        return node;
+    }
+
+    void free_node(Octree_Node *node) {
+        node->~Octree_Node();
+        node->children[0] = free_nodes;
+        free_nodes = node;
+    }
+
+    // Returns the number of payloads in the subtree.
+    size_t collapse(Octree_Node *node) {
+        size_t count = node->upon_line.size();
+
+        for (int i = 0; i < child_count; i++) {
+            if (node->children[i] != null) {
+                count += collapse(node->children[i]);
+            }
+        }
+
+        if (count <= leaf_capacity && !is_leaf(node)) {
+            for (int i = 0; i < child_count; i++) {
+                if (node->children[i] != null) {
+                    gather(node->children[i], node->upon_line);
+                    node->children[i] = null;
+                }
+            }
         }
+
+        return count;
+    }
+
+    // Moves all payloads of the subtree into out and frees its nodes.
+    void gather(Octree_Node *node, std::vector<T>& out) {
+        out.insert(out.end(), node->upon_line.begin(), node->upon_line.end());
+
+        for (int i = 0; i < child_count; i++) {
+            if (node->children[i] != null) {
+                gather(node->children[i], out);
+            }
+        }
+
+        free_node(node);
+    }
+
+    void destroy(Octree_Node *node) {
+        for (int i = 0; i < child_count; i++) {
+            if (node->children[i] != null) {
+                destroy(node->children[i]);
+            }
+        }
+
+        node->~Octree_Node();
     }
 };
 
@@ -130,49 +429,321 @@ void tris_from_cc_quadrilateral(std::vector<triangle>& tris, const quadrilateral
 
 bool tri_is_winding_cc(const triangle& tri);
 f32 tri_area(const triangle& tri);
+f32 tri_min_height_to_ground_ratio(const triangle& tri);
+
+// A subtrahend with its per triangle quantities computed once, since tri_in_mesh
+// subtracts every occluder triangle from many remainders.
+struct prepared_triangle {
+    triangle tri;
+    glm::vec2 sides[3];   // pts[(i + 1) % 3] - pts[i].
+    glm::vec2 normals[3]; // Unnormalized, pointing outwards for counter-clockwise winding.
+    f32 side_lens[3];
+    BBox bbox;
+    f32 area;
+    bool winding_cc;
+};
+
+prepared_triangle prepare_triangle(const triangle& tri);
 
 void subtract_triangles(const triangle& minuend, const triangle& subtr, std::vector<triangle>& tris);
-bool tri_in_mesh(const triangle& tri, const std::vector<triangle>& tris, f32 min_rem_area = 1e-3);
+void subtract_triangles(const triangle& minuend, const prepared_triangle& subtr, std::vector<triangle>& tris);
+// Bounds the work of the slow path for one mesh. Running out counts as not occluded,
+// which is conservative. Limits of 0 mean no limit.
+struct Occl_Work_Budget {
+    u64 max_subtractions;
+    u64 max_cycles;
+
+    u64 subtractions;
+    u64 start_cycles;
+    bool exhausted;
+
+    Occl_Work_Budget(u64 max_subtractions, u64 max_cycles);
+    bool spend_subtraction();
+};
+
+void merge_remainders(std::vector<triangle>& tris);
+bool tri_in_mesh(const triangle& tri, const std::vector<triangle>& tris, f32 min_rem_area = 1e-3, Occl_Work_Budget *budget = null);
+bool tri_in_mesh(const triangle& tri, std::span<const prepared_triangle> tris, f32 min_rem_area = 1e-3, Occl_Work_Budget *budget = null);
 
 std::string to_string(const glm::vec2& v);
 std::string to_string(const triangle& tri);
 void print(const std::vector<triangle>& tris);
 void print(const std::vector<glm::vec2>& pts);
 
+struct Occl_Mesh_Pool;
+
+struct Occl_Slow_Path_Params {
+    f32 min_rem_area = 1e-3f;
+    u64 max_subtractions = 0; // Per mesh test, 0 for no limit.
+    u64 max_cycles = 0;       // Per mesh test, 0 for no limit.
+};
+
+// Cells per side of the coverage mask that the occluded trees keep in every node, and the
+// depth down to which they get nodes around every occluder, which bounds the mask resolution.
+constexpr int occl_coverage_cells = 8;
+constexpr int occl_coverage_depth = 3;
+
+// Offsets into the pool that holds the geometry, so meshes are cheap to copy around.
 struct Occl_Mesh {
     BBox bbox;
-    std::vector<glm::vec2> convex_hull;
-    std::vector<triangle> mesh_proj;
+    const Occl_Mesh_Pool *pool;
+    u32 id; // Index of the mesh in its pool.
+    u32 hull_offset, hull_count;
+    u32 tri_count;
+
+    std::span<const glm::vec2> convex_hull() const;
+    // Triangulated on first use and cached in the pool, thread-safe.
+    std::span<const triangle> mesh_proj() const;
 
-    Occl_Mesh(std::vector<glm::vec2> _convex_hull);
     int compare(f32 value, uint dim) const;
-    bool inside_fast(const Occl_Mesh *other);
-    bool intersect(const Occl_Mesh *other);
-    bool bbox_intersect(const BBox& other_bbox);
-    bool inside(Octree<Occl_Mesh *>& tree);
+    bool inside_fast(const Occl_Mesh *other) const;
+    bool intersect(const Occl_Mesh *other) const;
+    bool bbox_intersect(const BBox& other_bbox) const;
+    // Bit y * occl_coverage_cells + x is set if that cell of box lies inside the hull.
+    u64 coverage_mask(const BBox& box) const;
+    // True if every cell the bbox overlaps is covered in the mask of its node, or in turn
+    // by the cells of the child below it.
+    bool inside_masks(const Octree<Occl_Mesh *>& tree) const;
+    // Triangles in covered count as occluders in addition to the ones in the tree.
+    // out_of_budget is set if the slow path gave up on the work budget of params.
+    bool inside(const Octree<Occl_Mesh *>& tree, const Occl_Slow_Path_Params& params = {},
+                const std::vector<triangle> *covered = null, bool *out_of_budget = null) const;
+};
+
+// Inserts an occluder and adds it to the coverage masks of the nodes it overlaps, so meshes
+// covered by several occluders can be accepted without subtracting triangles.
+// Occluders inside the new one are evicted, returns how many.
+int occluded_tree_insert(Octree<Occl_Mesh *>& tree, Occl_Mesh *mesh);
+
+// Hull vertices of many meshes back to back. Growing it moves the vertices but not
+// the offsets, so meshes stay valid as long as the pool lives.
+// Triangles are only built for meshes that reach the slow path. They live in chunks
+// that never move, so cached triangles can be read while other threads add more.
+// Adding meshes must not overlap with any reads though.
+struct Occl_Mesh_Pool {
+    static constexpr u32 tri_chunk_size = 4096;
+
+    std::vector<glm::vec2> pts;
+    mutable std::deque<std::atomic<const triangle *>> tri_cache; // Per mesh, null until triangulated.
+
+    mutable std::mutex tri_mutex;
+    mutable std::vector<std::unique_ptr<triangle[]>> tri_chunks;
+    mutable u32 tri_chunk_used;
+
+    size_t dead_pts; // Hull points of removed meshes, until compact reclaims them.
+
+    Occl_Mesh_Pool();
+    Occl_Mesh add(std::span<const glm::vec2> convex_hull);
+    void reserve(size_t mesh_count, size_t pts_per_mesh = 8);
+    // The mesh must not be used afterwards, its storage is reclaimed by the next compact.
+    void remove(const Occl_Mesh& mesh);
+    // Moves the hulls of the given meshes together and drops all cached triangles.
+    // Every mesh of the pool still in use must be passed, their offsets and ids change.
+    void compact(std::span<Occl_Mesh> meshes);
+    void clear();
+    const triangle *triangulate(const Occl_Mesh& mesh) const;
 };
 
+inline std::span<const glm::vec2> Occl_Mesh::convex_hull() const {
+    return {pool->pts.data() + hull_offset, hull_count};
+}
+
+inline std::span<const triangle> Occl_Mesh::mesh_proj() const {
+    if (tri_count == 0) {
+        return {};
+    }
+
+    const triangle *tris = pool->tri_cache[id].load(std::memory_order_acquire);
+    if (tris == null) {
+        tris = pool->triangulate(*this);
+    }
+
+    return {tris, tri_count};
+}
+
 enum class Occl_Cull_Flag : u8 {
     DRAWN = 1,
     OCCLUDED = 2
 };
 
-struct Occl_Cull_Context {
-    bump_allocator draw_tree_alloc;
+// One bit per mesh, 64 meshes to a word. Bits past count are always 0.
+struct Occl_Bitset {
+    std::vector<u64> words;
+    size_t count;
+
+    Occl_Bitset() : count(0) {}
+
+    void reserve(size_t n) { words.reserve((n + 63) / 64); }
+    // Resizes to n bits, all 0.
+    void assign(size_t n) { count = n; words.assign((n + 63) / 64, 0); }
+    void push_back(bool value);
+    size_t size() const { return count; }
+
+    bool get(size_t i) const { return (words[i >> 6] >> (i & 63)) & 1; }
+    void set(size_t i) { words[i >> 6] |= (u64)1 << (i & 63); }
+    void unset(size_t i) { words[i >> 6] &= ~((u64)1 << (i & 63)); }
+
+    // Appends the indices of the set bits in ascending order.
+    void compact(std::vector<int>& indices) const;
+    bool operator==(const Occl_Bitset& other) const = default;
+};
+
+// Per mesh flags as one bitset per Occl_Cull_Flag.
+struct Occl_Flag_Bits {
+    Occl_Bitset drawn, occluded;
+
+    void reserve(size_t n) { drawn.reserve(n); occluded.reserve(n); }
+    void assign(size_t n) { drawn.assign(n); occluded.assign(n); }
+    void push_back() { drawn.push_back(false); occluded.push_back(false); }
+    size_t size() const { return drawn.size(); }
+
+    const Occl_Bitset& bits(Occl_Cull_Flag flag) const { return (flag == Occl_Cull_Flag::DRAWN) ? drawn : occluded; }
+    u8 get(size_t i) const { return (u8)(drawn.get(i) * (u8)Occl_Cull_Flag::DRAWN | occluded.get(i) * (u8)Occl_Cull_Flag::OCCLUDED); }
+    void set(size_t i, Occl_Cull_Flag flag) { (flag == Occl_Cull_Flag::DRAWN) ? drawn.set(i) : occluded.set(i); }
+    void unset(size_t i, Occl_Cull_Flag flag) { (flag == Occl_Cull_Flag::DRAWN) ? drawn.unset(i) : occluded.unset(i); }
+    bool operator==(const Occl_Flag_Bits& other) const = default;
+};
+
+struct Occl_Capture_Writer;
+
+// Slow path cost attributed to a single mesh during the current frame.
+struct Occl_Mesh_Cost {
+    u32 slow_tests;
+    u64 subtractions;
+    u64 cycles;
+};
+
+struct Occl_Cull_Context;
+
+// Per view occlusion state on top of the draw side of a context, which it only reads.
+// Any number of views can share one context and run concurrently on different threads,
+// as long as no meshes are added to the context meanwhile.
+struct Occl_Cull_View {
+    const Occl_Cull_Context *ctx;
+
     bump_allocator occl_tree_alloc;
+    Octree<Occl_Mesh *> occluded_tree;
+
+    Occl_Flag_Bits flags;
+    // The meshes this view culled, as opposed to the ones flagged OCCLUDED by the caller,
+    // and the same for the last frame to diff against.
+    Occl_Bitset hidden, last_hidden;
+    std::vector<Occl_Mesh_Cost> costs; // Only tracked if OCCL_STATS is enabled.
+    Occl_Cull_Stats stats;
+
+    // If set, begin_frame seeds the occluded tree with the occluders of the last frame,
+    // so most meshes are decided by the fast path before the first submission.
+    // end_frame then re-checks whatever got rejected, if some seeds were not submitted again.
+    bool temporal;
+    static constexpr u8 SEED_UNCONFIRMED = 1;
+    static constexpr u8 SEED_CONFIRMED = 2;
+    std::vector<u8> seeds;
+    std::vector<int> occluders;      // In insertion order, the tree drops the ones inside a later one.
+    std::vector<int> last_occluders;
+    // Only tracked while there are unconfirmed seeds, along with whether the caller submitted them.
+    std::vector<std::pair<int, bool>> rejected;
+    int unconfirmed_seeds;
+
+    // If positive, only the best occluder_budget candidates passed to select_occluders are
+    // inserted into the occluded tree. Other flagged meshes are only tested, like plain draw meshes.
+    int occluder_budget;
+    bool selection_active;
+    std::vector<u8> selected;
+
+    // If set, begin_frame keeps the flags of all meshes away from the dirty regions of the context
+    // and clears only the others for the caller to flag again. Occluders that did not change stay
+    // in the tree. The caller must flag the meshes the same way every frame, unless their bbox is
+    // marked dirty. Ignored for temporal views.
+    bool incremental;
+    bool incremental_frame; // This frame kept the flags outside of the dirty regions.
+    u64 dirty_seen;         // Dirty regions of the context up to here were applied already.
+    Occl_Bitset dirty;      // Meshes cleared by the current incremental frame.
+
+    Occl_Cull_View(const Occl_Cull_Context *ctx, f32 looseness = 0.0f);
+    // Also picks up meshes that were added to the context since the last frame.
+    void begin_frame();
+    // Only needed for temporal views, the flags are final afterwards.
+    void end_frame();
+    // Projected area times compactness times the number of draw meshes it hides on its own.
+    f32 occluder_score(int index) const;
+    // Call after begin_frame with every mesh that might be flagged this frame.
+    void select_occluders(const std::vector<int>& candidates);
+    void flag_mesh(int index, Occl_Cull_Flag flag);
+    u8 get_flags(int index);
+    // The index lists below are appended to in ascending order.
+    void flagged_indices(Occl_Cull_Flag flag, std::vector<int>& indices) const;
+    void hidden_indices(std::vector<int>& indices) const;
+    // Meshes that changed since the last frame, meshes new to this frame count as visible before.
+    void frame_diff(std::vector<int>& newly_visible, std::vector<int>& newly_hidden) const;
+
+private:
+    // Draw tree query results of insert_occluder, kept so flag calls don't allocate.
+    std::vector<Occl_Mesh *> inside_scratch, affected_scratch;
+
+    // Returns false if the dirty regions since the last frame are not known anymore.
+    bool begin_incremental_frame();
+    bool test_occluded(int index, bool *out_of_budget = null);
+    void reject(int index, bool submitted = false);
+    void insert_occluder(int index, Occl_Phase_Clock& clock);
+};
 
+struct Occl_Dirty_Region {
+    BBox bbox;
+    int index; // Of the changed mesh, -1 for regions passed to mark_dirty.
+};
+
+struct Occl_Cull_Context {
+    bump_allocator draw_tree_alloc;
     Octree<Occl_Mesh *> draw_tree;
-    Octree<Occl_Mesh *> occluded_tree;
 
-    std::vector<u8> flags;
+    Occl_Mesh_Pool pool;
     std::vector<Occl_Mesh> meshes;
     size_t reserved;
 
-    int total_occluded, total_fast, total_slow;
+    // Sector of every mesh slot, -1 for slots freed by unload_sector. add_mesh reuses the lowest
+    // free slot first, so the reserve only has to cover the meshes loaded at the same time.
+    std::vector<int> mesh_sectors;
+    std::vector<int> free_slots; // Min-heap.
+
+    // Regions changed by mesh updates since the views last began a frame, see Occl_Cull_View::incremental.
+    // dirty_base counts the regions dropped from the front so far.
+    std::vector<Occl_Dirty_Region> dirty_regions;
+    u64 dirty_base;
+    // Past this many, the regions are dropped and the views cull their next frame in full.
+    static constexpr size_t max_dirty_regions = 1024;
+
+    Occl_Slow_Path_Params slow_path; // Used by all views and tiles of this context.
+
+    Occl_Cull_View view; // The default view, the per frame calls below go there.
+    Occl_Capture_Writer *capture;
     
-    Occl_Cull_Context(size_t reserve, const BBox& clip_box);
-    void add_mesh(const Occl_Mesh&& mesh);
+    Occl_Cull_Context(size_t reserve, const BBox& clip_box, f32 looseness = 0.0f);
+    ~Occl_Cull_Context();
+    // Records all meshes added so far and every following call into a binary capture.
+    bool start_capture(const char *path);
+    void stop_capture();
+    // Writes both trees, the occluders and the per mesh costs as JSON for tools/triangle_visualizer.py.
+    bool export_heatmap(const char *path) const;
+    // Returns the index of the mesh. Sectors are chosen by the caller and must not be negative.
+    int add_mesh(std::span<const glm::vec2> convex_hull, int sector = 0);
+    // Removes every mesh of the sector from the draw tree and frees their slots for add_mesh.
+    // Only call between frames, views must not be culling meanwhile.
+    void unload_sector(int sector);
+    // Replaces the hull of a mesh, which keeps its slot and sector. Only call between frames.
+    void update_mesh(int index, std::span<const glm::vec2> convex_hull);
+    // For changes the context does not see itself, such as a mesh flagged differently than last frame.
+    void mark_dirty(const BBox& bbox);
+    // Same as mark_dirty, without recording it to the capture.
+    void add_dirty(const BBox& bbox, int index = -1);
+    void begin_frame();
+    void end_frame();
+    void select_occluders(const std::vector<int>& candidates);
     void flag_mesh(int index, Occl_Cull_Flag flag);
     u8 get_flags(int index);
+    void flagged_indices(Occl_Cull_Flag flag, std::vector<int>& indices) const;
+    void hidden_indices(std::vector<int>& indices) const;
+    void frame_diff(std::vector<int>& newly_visible, std::vector<int>& newly_hidden) const;
+    Occl_Cull_Stats snapshot_stats() const;
+    void reset_stats();
     size_t get_total_tri_count(); // TODO: Remove later.
-};
\ No newline at end of file
+};
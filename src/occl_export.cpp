@@ -0,0 +1,70 @@
+#include "occl_cull.h"
+
+// JSON export of a context for the heatmap mode of tools/triangle_visualizer.py.
+
+static void write_bbox(FILE *file, const BBox& bbox) {
+    fprintf(file, "[%.9g, %.9g, %.9g, %.9g]", bbox.tl.x, bbox.tl.y, bbox.br.x, bbox.br.y);
+}
+
+static void write_nodes(FILE *file, const Octree<Occl_Mesh *>& tree) {
+    bool first = true;
+    fprintf(file, "[");
+
+    tree.for_each_node([&](const Octree<Occl_Mesh *>::Octree_Node *node, int depth) {
+        fprintf(file, "%s\n    {\"bbox\": ", first ? "" : ",");
+        write_bbox(file, node->bbox);
+        fprintf(file, ", \"depth\": %d, \"count\": %zu}", depth, node->upon_line.size());
+        first = false;
+    });
+
+    fprintf(file, "\n  ]");
+}
+
+bool Occl_Cull_Context::export_heatmap(const char *path) const {
+    FILE *file = fopen(path, "w");
+    if (file == null) {
+        print_error("Failed to open '%s' for writing.\n", path);
+        return false;
+    }
+
+    fprintf(file, "{\n  \"clip_box\": ");
+    write_bbox(file, draw_tree.root->bbox);
+
+    fprintf(file, ",\n  \"draw_nodes\": ");
+    write_nodes(file, draw_tree);
+    fprintf(file, ",\n  \"occluded_nodes\": ");
+    write_nodes(file, view.occluded_tree);
+
+    bool first = true;
+    fprintf(file, ",\n  \"occluders\": [");
+    view.occluded_tree.for_each_node([&](const Octree<Occl_Mesh *>::Octree_Node *node, int) {
+        for (const Occl_Mesh *mesh: node->upon_line) {
+            fprintf(file, "%s\n    [", first ? "" : ",");
+
+            std::span<const glm::vec2> hull = mesh->convex_hull();
+
+            for (size_t i = 0; i < hull.size(); i++) {
+                const glm::vec2& p = hull[i];
+                fprintf(file, "%s[%.9g, %.9g]", (i == 0) ? "" : ", ", p.x, p.y);
+            }
+
+            fprintf(file, "]");
+            first = false;
+        }
+    });
+    fprintf(file, "\n  ]");
+
+    fprintf(file, ",\n  \"meshes\": [");
+    for (size_t i = 0; i < meshes.size(); i++) {
+        const Occl_Mesh_Cost& cost = view.costs[i];
+
+        fprintf(file, "%s\n    {\"bbox\": ", (i == 0) ? "" : ",");
+        write_bbox(file, meshes[i].bbox);
+        fprintf(file, ", \"flags\": %u, \"slow_tests\": %u, \"subtractions\": %llu, \"cycles\": %llu}",
+            view.flags.get(i), cost.slow_tests, (unsigned long long)cost.subtractions, (unsigned long long)cost.cycles);
+    }
+    fprintf(file, "\n  ]\n}\n");
+
+    fclose(file);
+    return true;
+}
@@ -0,0 +1,146 @@
+#pragma once
+#include "util.h"
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Set to false to compile all counters and timers out of the hot paths.
+#ifndef OCCL_STATS
+#define OCCL_STATS true
+#endif
+
+enum class Occl_Phase : u8 {
+    SELF_TEST,       // Is the new occluder itself already occluded?
+    OCCLUDER_INSERT, // Insertion into the occluded tree.
+    DRAW_QUERY,      // Gathering candidate draw meshes from the draw tree.
+    FAST_FLAG,       // Flagging draw meshes contained in the new occluder.
+    SLOW_FLAG,       // Triangle subtraction fallback for the remaining ones.
+    COUNT
+};
+
+// Bucket i counts remainder sets of size [2^(i - 1), 2^i), bucket 0 counts empty ones.
+constexpr int occl_rem_histogram_size = 10;
+
+struct Occl_Cull_Stats {
+    // These are always counted.
+    int total_occluded, total_fast, total_slow;
+    int total_seeded, total_revived; // Temporal views only.
+    int total_unselected;             // Flagged meshes left out of the occluder budget.
+    int total_cached;                 // Flags kept from the last frame, incremental views only.
+    int total_evicted;                // Occluders removed from the tree inside a newer one.
+
+    // These are only counted if OCCL_STATS is enabled.
+    u64 flag_calls;
+    u64 nodes_visited;
+    u64 inside_fast_calls, inside_fast_hits;
+    u64 mask_hits; // Meshes accepted by the coverage masks of the occluded tree.
+    u64 slow_path_calls;
+    u64 subtract_calls;
+    u64 tri_in_mesh_calls;
+    u64 triangulations;
+    u64 budget_exhausted; // Slow path tests cut short by Occl_Work_Budget.
+    u64 remainders_merged; // Remainder triangles saved by merging them back into convex polygons.
+    u64 sat_disjoint, sat_inside; // Subtractions decided by the separating axis test alone.
+    u64 rem_histogram[occl_rem_histogram_size];
+    u64 phase_cycles[(int)Occl_Phase::COUNT];
+
+    void reset() {
+        *this = {};
+    }
+
+    void add(const Occl_Cull_Stats& other) {
+        total_occluded += other.total_occluded;
+        total_fast += other.total_fast;
+        total_slow += other.total_slow;
+        total_seeded += other.total_seeded;
+        total_revived += other.total_revived;
+        total_unselected += other.total_unselected;
+        total_cached += other.total_cached;
+        total_evicted += other.total_evicted;
+
+        flag_calls += other.flag_calls;
+        nodes_visited += other.nodes_visited;
+        inside_fast_calls += other.inside_fast_calls;
+        inside_fast_hits += other.inside_fast_hits;
+        mask_hits += other.mask_hits;
+        slow_path_calls += other.slow_path_calls;
+        subtract_calls += other.subtract_calls;
+        tri_in_mesh_calls += other.tri_in_mesh_calls;
+        triangulations += other.triangulations;
+        budget_exhausted += other.budget_exhausted;
+        remainders_merged += other.remainders_merged;
+        sat_disjoint += other.sat_disjoint;
+        sat_inside += other.sat_inside;
+
+        for (int i = 0; i < occl_rem_histogram_size; i++) rem_histogram[i] += other.rem_histogram[i];
+        for (int i = 0; i < (int)Occl_Phase::COUNT; i++) phase_cycles[i] += other.phase_cycles[i];
+    }
+};
+
+void print(const Occl_Cull_Stats& stats);
+
+inline u64 occl_read_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+inline int occl_rem_histogram_bucket(size_t count) {
+    int bucket = 0;
+
+    while (count > 0 && bucket < occl_rem_histogram_size - 1) {
+        count >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+#if OCCL_STATS
+// The free functions below the context (subtraction, octree traversal) count
+// into whatever stats the calling thread is currently flagging for.
+extern thread_local Occl_Cull_Stats *occl_active_stats;
+
+#define OCCL_STAT_ADD(field, n) do { if (occl_active_stats) occl_active_stats->field += (n); } while (0)
+#define OCCL_STAT_REM_COUNT(n) do { if (occl_active_stats) occl_active_stats->rem_histogram[occl_rem_histogram_bucket(n)]++; } while (0)
+
+struct Occl_Stats_Scope {
+    Occl_Cull_Stats *prev;
+
+    Occl_Stats_Scope(Occl_Cull_Stats *stats) : prev(occl_active_stats) {
+        occl_active_stats = stats;
+    }
+
+    ~Occl_Stats_Scope() {
+        occl_active_stats = prev;
+    }
+};
+
+struct Occl_Phase_Clock {
+    u64 last;
+
+    Occl_Phase_Clock() : last(occl_read_cycles()) {}
+
+    // Attributes the cycles since the last lap to the given phase.
+    void lap(Occl_Phase phase) {
+        u64 now = occl_read_cycles();
+        OCCL_STAT_ADD(phase_cycles[(int)phase], now - last);
+        last = now;
+    }
+};
+#else
+#define OCCL_STAT_ADD(field, n) do {} while (0)
+#define OCCL_STAT_REM_COUNT(n) do {} while (0)
+
+struct Occl_Stats_Scope {
+    Occl_Stats_Scope(Occl_Cull_Stats *) {}
+};
+
+struct Occl_Phase_Clock {
+    void lap(Occl_Phase) {}
+};
+#endif
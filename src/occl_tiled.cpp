@@ -0,0 +1,168 @@
+#include "occl_tiled.h"
+#include "occl_trace.h"
+#include <atomic>
+#include <thread>
+
+Occl_Cull_Tile::Occl_Cull_Tile(const BBox& bbox, f32 looseness)
+    : bbox(bbox), occl_tree_alloc(1024 * 512), occluded_tree(&occl_tree_alloc, bbox, looseness), stats{} {}
+
+bool Occl_Cull_Tile::test_covered(const Occl_Mesh& mesh, const Occl_Slow_Path_Params& params, bool *out_of_budget) {
+    // Everything outside of the tile counts as covered, so only the part inside has to be occluded.
+    // The outside is cut from the mesh bbox padded a little, as up to four rectangles.
+    BBox outer = mesh.bbox;
+    outer.tl -= glm::vec2(1e-3f);
+    outer.br += glm::vec2(1e-3f);
+
+    std::vector<triangle> outside;
+    auto add_rect = [&](glm::vec2 tl, glm::vec2 br) {
+        if (tl.x < br.x && tl.y < br.y) {
+            tris_from_cc_quadrilateral(outside, {{tl, {br.x, tl.y}, br, {tl.x, br.y}}});
+        }
+    };
+
+    f32 inner_tl_x = std::max(outer.tl.x, bbox.tl.x);
+    f32 inner_br_x = std::min(outer.br.x, bbox.br.x);
+    add_rect(outer.tl, {bbox.tl.x, outer.br.y});
+    add_rect({bbox.br.x, outer.tl.y}, outer.br);
+    add_rect({inner_tl_x, outer.tl.y}, {inner_br_x, bbox.tl.y});
+    add_rect({inner_tl_x, bbox.br.y}, {inner_br_x, outer.br.y});
+
+    return mesh.inside(occluded_tree, params, outside.empty() ? null : &outside, out_of_budget);
+}
+
+void Occl_Cull_Tile::cull(const Occl_Cull_Context *ctx, const std::vector<int>& order) {
+    OCCL_TRACE_SCOPE("tile_cull", "meshes", (i64)order.size());
+    const std::vector<Occl_Mesh>& meshes = ctx->meshes;
+    Occl_Stats_Scope stats_scope(&stats);
+
+    covered.assign(meshes.size(), 0);
+    submitted.assign(meshes.size(), 0);
+    occluded_tree.clear();
+
+    for (int index: order) {
+        const Occl_Mesh& occl_mesh = meshes[index];
+
+        if (covered[index] || !occl_mesh.bbox_intersect(bbox)) continue;
+
+        bool out_of_budget = false;
+        if (test_covered(occl_mesh, ctx->slow_path, &out_of_budget)) {
+            covered[index] = 1;
+            continue;
+        }
+
+        // Same as for views, it would add a lot of triangles but hardly any coverage.
+        if (out_of_budget) continue;
+
+        // Occluders are never covered by what comes after them, themselves included.
+        submitted[index] = 1;
+
+        // The trees only store non-const pointers, the payloads are never written to though.
+        stats.total_evicted += occluded_tree_insert(occluded_tree, const_cast<Occl_Mesh *>(&occl_mesh));
+
+        std::vector<Occl_Mesh *> inside_meshes;
+        std::vector<Occl_Mesh *> affected_meshes;
+        ctx->draw_tree.intersect(const_cast<Occl_Mesh *>(&occl_mesh), inside_meshes, affected_meshes);
+        stats.total_occluded++;
+
+        for (Occl_Mesh *mesh: inside_meshes) {
+            int i = mesh - meshes.data();
+            if (covered[i] || submitted[i] || !mesh->bbox_intersect(bbox)) continue;
+
+            covered[i] = 1;
+            stats.total_fast++;
+        }
+
+        for (Occl_Mesh *mesh: affected_meshes) {
+            int i = mesh - meshes.data();
+            if (covered[i] || submitted[i] || !mesh->bbox_intersect(bbox)) continue;
+
+            if (test_covered(*mesh, ctx->slow_path)) {
+                covered[i] = 1;
+                stats.total_slow++;
+            }
+        }
+    }
+}
+
+Occl_Tiled_Cull::Occl_Tiled_Cull(const Occl_Cull_Context *ctx, int tiles_x, int tiles_y, f32 looseness)
+    : ctx(ctx), tiles_x(tiles_x), tiles_y(tiles_y), stats{} {
+    assert(tiles_x > 0 && tiles_y > 0);
+
+    const BBox& clip_box = ctx->draw_tree.root->bbox;
+    glm::vec2 size = (clip_box.br - clip_box.tl) / glm::vec2(tiles_x, tiles_y);
+
+    for (int y = 0; y < tiles_y; y++) {
+        for (int x = 0; x < tiles_x; x++) {
+            glm::vec2 tl = clip_box.tl + size * glm::vec2(x, y);
+            glm::vec2 br = clip_box.tl + size * glm::vec2(x + 1, y + 1);
+
+            // The last row and column end exactly on the clip box.
+            if (x == tiles_x - 1) br.x = clip_box.br.x;
+            if (y == tiles_y - 1) br.y = clip_box.br.y;
+
+            tiles.push_back(new Occl_Cull_Tile({tl, br}, looseness));
+        }
+    }
+}
+
+Occl_Tiled_Cull::~Occl_Tiled_Cull() {
+    for (Occl_Cull_Tile *tile: tiles) {
+        delete tile;
+    }
+}
+
+void Occl_Tiled_Cull::cull(const std::vector<int>& order, int thread_count) {
+    std::atomic<int> next_tile = 0;
+    auto worker = [&]() {
+        for (int t = next_tile++; t < (int)tiles.size(); t = next_tile++) {
+            tiles[t]->cull(ctx, order);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < thread_count; i++) {
+        threads.emplace_back(worker);
+    }
+
+    worker();
+    for (std::thread& thread: threads) {
+        thread.join();
+    }
+
+    // Merge, a mesh needs the agreement of every tile it overlaps.
+    flags.assign(ctx->meshes.size());
+    hidden.assign(ctx->meshes.size());
+    stats.reset();
+
+    for (int index: order) {
+        flags.set(index, Occl_Cull_Flag::OCCLUDED);
+    }
+
+    for (size_t i = 0; i < ctx->meshes.size(); i++) {
+        const Occl_Mesh& mesh = ctx->meshes[i];
+        bool occluded = true, overlaps = false;
+
+        for (const Occl_Cull_Tile *tile: tiles) {
+            if (!::bbox_intersect(mesh.bbox, tile->bbox)) continue;
+
+            overlaps = true;
+            occluded &= tile->covered[i] != 0;
+        }
+
+        if (overlaps && occluded) {
+            hidden.set(i);
+        }
+    }
+
+    for (const Occl_Cull_Tile *tile: tiles) {
+        stats.add(tile->stats);
+    }
+}
+
+u8 Occl_Tiled_Cull::get_flags(int index) {
+    return flags.get(index);
+}
+
+void Occl_Tiled_Cull::hidden_indices(std::vector<int>& indices) const {
+    hidden.compact(indices);
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "occl_cull.h"
+
+// Culls a context with the clip box split into a grid of screen tiles. Every tile
+// owns its occluded tree and only judges the part of a mesh that lies inside of it,
+// so tiles share no mutable state and can be culled on separate workers.
+// A mesh is occluded only if every tile it overlaps agrees.
+
+struct Occl_Cull_Tile {
+    BBox bbox;
+    bump_allocator occl_tree_alloc;
+    Octree<Occl_Mesh *> occluded_tree;
+
+    std::vector<u8> covered;   // Per mesh, 1 if its part inside this tile is occluded.
+    std::vector<u8> submitted; // Per mesh, 1 if this tile took it in as an occluder.
+    Occl_Cull_Stats stats;
+
+    Occl_Cull_Tile(const BBox& bbox, f32 looseness);
+    void cull(const Occl_Cull_Context *ctx, const std::vector<int>& order);
+
+private:
+    bool test_covered(const Occl_Mesh& mesh, const Occl_Slow_Path_Params& params, bool *out_of_budget = null);
+};
+
+struct Occl_Tiled_Cull {
+    const Occl_Cull_Context *ctx;
+    int tiles_x, tiles_y;
+    std::vector<Occl_Cull_Tile *> tiles;
+
+    Occl_Flag_Bits flags;  // What cull was given, every mesh in order is flagged OCCLUDED.
+    Occl_Bitset hidden;    // Meshes every overlapped tile agrees on.
+    Occl_Cull_Stats stats; // Sum over all tiles.
+
+    Occl_Tiled_Cull(const Occl_Cull_Context *ctx, int tiles_x, int tiles_y, f32 looseness = 0.0f);
+    ~Occl_Tiled_Cull();
+
+    Occl_Tiled_Cull(const Occl_Tiled_Cull&) = delete;
+    void operator=(const Occl_Tiled_Cull&) = delete;
+
+    // Flags the meshes in order as occluders, like one flag_mesh call each on a fresh view.
+    // Tiles are spread over thread_count workers, 1 culls on the calling thread.
+    void cull(const std::vector<int>& order, int thread_count);
+    u8 get_flags(int index);
+    void hidden_indices(std::vector<int>& indices) const;
+};
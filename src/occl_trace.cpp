@@ -0,0 +1,85 @@
+#include "occl_trace.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+static_assert((occl_trace_capacity & (occl_trace_capacity - 1)) == 0);
+
+#if OCCL_TRACE
+
+static Occl_Trace_Event occl_trace_ring[occl_trace_capacity];
+static std::atomic<u64> occl_trace_head{0};
+static std::atomic<u32> occl_trace_next_thread{0};
+
+static u32 occl_trace_thread() {
+    thread_local u32 thread = occl_trace_next_thread.fetch_add(1, std::memory_order_relaxed);
+    return thread;
+}
+
+void occl_trace_record(const char *name, char phase, const char *arg_name, i64 arg) {
+    u64 ns = (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    u64 slot = occl_trace_head.fetch_add(1, std::memory_order_relaxed);
+
+    occl_trace_ring[slot & (occl_trace_capacity - 1)] = {name, arg_name, arg, ns, occl_trace_thread(), phase};
+}
+
+void occl_trace_clear() {
+    occl_trace_head.store(0, std::memory_order_relaxed);
+}
+
+void occl_trace_events(std::vector<Occl_Trace_Event>& events) {
+    u64 head = occl_trace_head.load(std::memory_order_relaxed);
+    u64 count = std::min<u64>(head, occl_trace_capacity);
+
+    events.clear();
+    for (u64 i = head - count; i < head; i++) {
+        events.push_back(occl_trace_ring[i & (occl_trace_capacity - 1)]);
+    }
+}
+#else
+void occl_trace_record(const char *, char, const char *, i64) {}
+void occl_trace_clear() {}
+void occl_trace_events(std::vector<Occl_Trace_Event>& events) { events.clear(); }
+#endif
+
+bool occl_trace_dump(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (file == null) {
+        print_error("Failed to open '%s' for writing.\n", path);
+        return false;
+    }
+
+    std::vector<Occl_Trace_Event> events;
+    occl_trace_events(events);
+
+    // Open scopes per thread, to drop the ends of scopes that began before the oldest event.
+    std::vector<int> depths;
+    bool first = true;
+
+    fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+    for (const Occl_Trace_Event& event: events) {
+        if (event.thread >= depths.size()) depths.resize(event.thread + 1, 0);
+
+        int& depth = depths[event.thread];
+        if (event.phase == 'E') {
+            if (depth == 0) continue;
+            depth--;
+        } else {
+            depth++;
+        }
+
+        fprintf(file, "%s\n  {\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": 0, \"tid\": %u",
+            first ? "" : ",", event.name, event.phase, (double)event.ns / 1000.0, event.thread);
+
+        if (event.arg_name != null) {
+            fprintf(file, ", \"args\": {\"%s\": %ld}", event.arg_name, event.arg);
+        }
+
+        fprintf(file, "}");
+        first = false;
+    }
+    fprintf(file, "\n]}\n");
+
+    fclose(file);
+    return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include "util.h"
+#include <vector>
+
+// Timeline of the culling phases, dumped as Chrome trace-event JSON for
+// chrome://tracing or ui.perfetto.dev. Scopes record a begin and an end event
+// into a ring buffer shared by all threads, so only the latest events are kept.
+//
+// The ring is best-effort under concurrent writers: each claims its slot atomically but copies
+// the event in unsynchronized, so a writer a whole ring ahead or a concurrent read can tear it.
+
+// Set to true to compile the scopes into the hot paths and the ring into occl_trace.cpp.
+// When false the scopes expand to nothing and recording does nothing.
+#ifndef OCCL_TRACE
+#define OCCL_TRACE false
+#endif
+
+constexpr size_t occl_trace_capacity = 1 << 16; // Events, must be a power of two.
+
+struct Occl_Trace_Event {
+    const char *name;     // Must outlive the dump, string literals only.
+    const char *arg_name; // Null for events without an argument.
+    i64 arg;
+    u64 ns;
+    u32 thread;
+    char phase; // 'B' or 'E'.
+};
+
+void occl_trace_record(const char *name, char phase, const char *arg_name = null, i64 arg = 0);
+// Drops all recorded events.
+void occl_trace_clear();
+// Copies the events still in the ring out, oldest first.
+void occl_trace_events(std::vector<Occl_Trace_Event>& events);
+// Ends whose begin was overwritten are left out. Call while no thread is recording.
+bool occl_trace_dump(const char *path);
+
+struct Occl_Trace_Scope {
+    const char *name;
+
+    Occl_Trace_Scope(const char *name, const char *arg_name = null, i64 arg = 0) : name(name) {
+        occl_trace_record(name, 'B', arg_name, arg);
+    }
+
+    ~Occl_Trace_Scope() {
+        occl_trace_record(name, 'E');
+    }
+};
+
+#if OCCL_TRACE
+#define OCCL_TRACE_SCOPE(...) Occl_Trace_Scope occl_trace_scope(__VA_ARGS__)
+#else
+#define OCCL_TRACE_SCOPE(...) do {} while (0)
+#endif
@@ -0,0 +1,47 @@
+#include "occl_world.h"
+
+int Occl_World_Object::compare(f32 value, uint dim) const {
+    if (aabb.br[dim] < value) {
+        return -1;
+    } else if(value < aabb.tl[dim]) {
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+bool Occl_World_Object::inside_fast(const Occl_World_Object *other) {
+    for (int d = 0; d < 3; d++) {
+        if (aabb.tl[d] < other->aabb.tl[d] || aabb.br[d] > other->aabb.br[d]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool Occl_World_Object::intersect(const Occl_World_Object *other) {
+    return ::bbox_intersect(aabb, other->aabb);
+}
+
+bool Occl_World_Object::bbox_intersect(const AABB& other_aabb) {
+    return ::bbox_intersect(aabb, other_aabb);
+}
+
+Occl_World_Broadphase::Occl_World_Broadphase(size_t reserve, const AABB& world_box, f32 looseness)
+    : tree_alloc(1024 * 512), tree(&tree_alloc, world_box, looseness), reserved(reserve) {
+    // The tree stores pointers into objects, so it must never reallocate.
+    objects.reserve(reserve);
+}
+
+void Occl_World_Broadphase::add_object(const AABB& aabb, int index) {
+    assert(objects.size() < reserved);
+
+    objects.push_back({aabb, index});
+    tree.insert(&objects.back());
+}
+
+void Occl_World_Broadphase::query(const AABB& region, std::vector<Occl_World_Object *>& insides, std::vector<Occl_World_Object *>& inters) {
+    Occl_World_Object region_object = {region, -1};
+    tree.intersect(&region_object, insides, inters);
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "occl_cull.h"
+#include <glm/vec3.hpp>
+
+// World space broadphase that rejects whole regions before anything gets projected
+// and turned into an Occl_Mesh. Objects are stored by their world space AABB in a 3d octree.
+
+struct Occl_World_Object {
+    AABB aabb;
+    int index; // Index of the object on the caller's side.
+
+    int compare(f32 value, uint dim) const;
+    bool inside_fast(const Occl_World_Object *other);
+    bool intersect(const Occl_World_Object *other);
+    bool bbox_intersect(const AABB& other_aabb);
+};
+
+struct Occl_World_Broadphase {
+    bump_allocator tree_alloc;
+    Octree<Occl_World_Object *, 3> tree;
+    std::vector<Occl_World_Object> objects;
+    size_t reserved;
+
+    Occl_World_Broadphase(size_t reserve, const AABB& world_box, f32 looseness = 0.0f);
+    void add_object(const AABB& aabb, int index);
+    // Collects the objects fully inside the region and the ones only overlapping it.
+    void query(const AABB& region, std::vector<Occl_World_Object *>& insides, std::vector<Occl_World_Object *>& inters);
+};
@@ -1,9 +1,14 @@
 #include "occl_cull.h"
+#include "occl_world.h"
+#include "occl_tiled.h"
+#include "occl_trace.h"
+#include "occl_capture.h"
 #include "algorithm.h"
 #include <glm/vec2.hpp>
 #include <glm/gtx/norm.hpp>
 #include <glm/gtx/string_cast.hpp>
 #include <string.h>
+#include <algorithm>
 
 inline bool intervals_intersect(f32 l_a, f32 r_a, f32 l_b, f32 r_b) {
     bool is_a_in_b = (l_b <= l_a && l_a <= r_b) || (l_b <= r_a && r_a <= r_b);
@@ -130,6 +135,17 @@ void test(std::string name, const triangle& minuend, const triangle& subtr, cons
     printf("\033[0m");
 }
 
+void test(std::string name, bool passed) {
+    test_total_counter++;
+
+    if (passed) {
+        printf("\033[32mTest '%s' passed!\033[0m\n", name.c_str());
+        test_passed_counter++;
+    } else {
+        printf("\033[31mTest '%s' failed!\033[0m\n", name.c_str());
+    }
+}
+
 void begin_test() {
     test_total_counter = 0;
     test_passed_counter = 0;
@@ -408,6 +424,769 @@ void triangle_boolean_tests() {
     end_test();
 }
 
+std::vector<Occl_Mesh> random_meshes(Occl_Mesh_Pool& pool, int count, f32 max_size, unsigned seed) {
+    srand(seed);
+    auto rand_f32 = []() { return (f32)rand() / (f32)RAND_MAX; };
+
+    std::vector<Occl_Mesh> meshes;
+    meshes.reserve(count);
+
+    for (int i = 0; i < count; i++) {
+        glm::vec2 center = {2.0f * rand_f32() - 1.0f, 2.0f * rand_f32() - 1.0f};
+        f32 size = max_size * rand_f32() + 1e-3f;
+
+        std::vector<glm::vec2> pts;
+        for (int j = 0; j < 6; j++) {
+            pts.push_back(center + size * glm::vec2(rand_f32() - 0.5f, rand_f32() - 0.5f));
+        }
+
+        inplace_convex_hull(pts);
+        meshes.push_back(pool.add(pts));
+    }
+
+    return meshes;
+}
+
+bool octree_matches_brute_force(std::vector<Occl_Mesh>& meshes, f32 looseness, int max_depth = Octree<Occl_Mesh *>::depth_limit,
+                                size_t leaf_capacity = 0) {
+    bump_allocator alloc(1024 * 1024 * 4);
+    Octree<Occl_Mesh *> tree(&alloc, {{-1, -1}, {1, 1}}, looseness);
+    tree.max_depth = max_depth;
+    tree.leaf_capacity = leaf_capacity;
+
+    for (Occl_Mesh& mesh: meshes) {
+        tree.insert(&mesh);
+    }
+
+    for (Occl_Mesh& query: meshes) {
+        std::vector<Occl_Mesh *> insides, inters;
+        tree.intersect(&query, insides, inters);
+
+        size_t expected = 0;
+        for (Occl_Mesh& mesh: meshes) {
+            expected += mesh.intersect(&query);
+        }
+
+        if (insides.size() + inters.size() != expected) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool broadphase_matches_brute_force(f32 looseness) {
+    srand(2);
+    auto rand_f32 = []() { return (f32)rand() / (f32)RAND_MAX; };
+
+    const int count = 500;
+    Occl_World_Broadphase broadphase(count, {{-1, -1, -1}, {1, 1, 1}}, looseness);
+
+    for (int i = 0; i < count; i++) {
+        glm::vec3 center = {2.0f * rand_f32() - 1.0f, 2.0f * rand_f32() - 1.0f, 2.0f * rand_f32() - 1.0f};
+        glm::vec3 extent = 0.15f * glm::vec3(rand_f32(), rand_f32(), rand_f32()) + 1e-3f;
+        broadphase.add_object({center - extent, center + extent}, i);
+    }
+
+    for (Occl_World_Object& query: broadphase.objects) {
+        std::vector<Occl_World_Object *> insides, inters;
+        broadphase.query(query.aabb, insides, inters);
+
+        size_t expected = 0, expected_insides = 0;
+        for (Occl_World_Object& object: broadphase.objects) {
+            expected += object.intersect(&query);
+            expected_insides += object.inside_fast(&query);
+        }
+
+        if (insides.size() + inters.size() != expected || insides.size() != expected_insides) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool lazy_triangulation_matches_hull() {
+    Occl_Mesh_Pool pool;
+    std::vector<glm::vec2> hull;
+    for (int i = 0; i < 9; i++) {
+        f32 angle = 2.0f * (f32)M_PI * (f32)i / 9.0f;
+        hull.push_back({cosf(angle), sinf(angle)});
+    }
+
+    Occl_Mesh mesh = pool.add(hull);
+    if (pool.tri_cache[mesh.id].load() != null) {
+        return false;
+    }
+
+    f32 area = 0.0f;
+    for (const triangle& tri: mesh.mesh_proj()) {
+        if (!tri_is_winding_cc(tri)) {
+            return false;
+        }
+
+        area += tri_area(tri);
+    }
+
+    // Area of the regular 9-gon with unit circumradius.
+    f32 expected = 0.5f * 9.0f * sinf(2.0f * (f32)M_PI / 9.0f);
+    return mesh.mesh_proj().size() == 7 && fabsf(area - expected) < 1e-4f && pool.tri_cache[mesh.id].load() == mesh.mesh_proj().data();
+}
+
+// Tiny meshes near the origin would descend far past max_depth, which the fixed visit stack relies on.
+bool octree_depth_is_capped() {
+    Occl_Mesh_Pool pool;
+    std::vector<glm::vec2> tiny = {{1e-20f, 1e-20f}, {2e-20f, 1e-20f}, {2e-20f, 2e-20f}};
+    Occl_Mesh mesh = pool.add(tiny);
+
+    bump_allocator alloc(1024 * 1024);
+    Octree<Occl_Mesh *> tree(&alloc, {{-1, -1}, {1, 1}});
+    tree.insert(&mesh);
+
+    int max_depth = 0;
+    tree.for_each_node([&](const Octree<Occl_Mesh *>::Octree_Node *, int depth) { max_depth = std::max(max_depth, depth); });
+
+    // The first visit stops the traversal.
+    int visited = 0;
+    bool finished = tree.visit([](const BBox&) { return true; }, [&](const Octree<Occl_Mesh *>::Octree_Node *) { visited++; return false; });
+
+    return max_depth == tree.max_depth && !finished && visited == 1;
+}
+
+// A mesh on the seam of two overlapping occluders is in neither, but in the cells of both masks.
+// The masks may miss covered meshes but must never accept one the slow path rejects.
+bool coverage_masks_are_conservative() {
+    Occl_Mesh_Pool pool;
+    std::vector<glm::vec2> left = {{-0.6f, -0.5f}, {0.05f, -0.5f}, {0.05f, 0.5f}, {-0.6f, 0.5f}};
+    std::vector<glm::vec2> right = {{-0.05f, -0.5f}, {0.6f, -0.5f}, {0.6f, 0.5f}, {-0.05f, 0.5f}};
+    std::vector<glm::vec2> seam = {{-0.2f, -0.1f}, {0.2f, -0.1f}, {0.2f, 0.1f}, {-0.2f, 0.1f}};
+    std::vector<glm::vec2> edge = {{-0.2f, 0.4f}, {0.2f, 0.4f}, {0.2f, 0.6f}, {-0.2f, 0.6f}};
+    Occl_Mesh occluders[2] = {pool.add(left), pool.add(right)};
+    Occl_Mesh inner = pool.add(seam), outer = pool.add(edge);
+
+    bump_allocator alloc(1024 * 1024);
+    Octree<Occl_Mesh *> tree(&alloc, {{-1, -1}, {1, 1}});
+    occluded_tree_insert(tree, &occluders[0]);
+    occluded_tree_insert(tree, &occluders[1]);
+
+    if (!inner.inside_masks(tree) || outer.inside_masks(tree) || !inner.inside(tree) || outer.inside(tree)) {
+        return false;
+    }
+
+    std::vector<Occl_Mesh> meshes = random_meshes(pool, 300, 0.4f, 7);
+    bump_allocator masked_alloc(1024 * 1024), plain_alloc(1024 * 1024);
+    Octree<Occl_Mesh *> masked(&masked_alloc, {{-1, -1}, {1, 1}}), plain(&plain_alloc, {{-1, -1}, {1, 1}});
+
+    for (int i = 0; i < 40; i++) {
+        occluded_tree_insert(masked, &meshes[i]);
+        plain.insert(&meshes[i]);
+    }
+
+    int accepted = 0;
+    for (size_t i = 40; i < meshes.size(); i++) {
+        if (meshes[i].inside_masks(masked)) {
+            if (!meshes[i].inside(plain)) return false;
+            accepted++;
+        }
+    }
+
+    return accepted > 0;
+}
+
+// Shallow trees with leaf buckets answer like the classic one, and collapsing after most
+// removals frees the nodes the remaining payloads do not need.
+bool bucketed_octree_matches_brute_force(std::vector<Occl_Mesh>& meshes) {
+    if (!octree_matches_brute_force(meshes, 0.0f, 6, 8)) {
+        return false;
+    }
+
+    bump_allocator alloc(1024 * 1024 * 4);
+    Octree<Occl_Mesh *> tree(&alloc, {{-1, -1}, {1, 1}});
+    tree.leaf_capacity = 8;
+
+    for (Occl_Mesh& mesh: meshes) {
+        tree.insert(&mesh);
+    }
+
+    for (size_t i = 0; i < meshes.size(); i++) {
+        if (i % 10 != 0 && !tree.remove(&meshes[i])) {
+            return false;
+        }
+    }
+
+    auto count_nodes = [&]() {
+        size_t count = 0, payloads = 0;
+        tree.for_each_node([&](const Octree<Occl_Mesh *>::Octree_Node *node, int) { count++; payloads += node->upon_line.size(); });
+        return std::make_pair(count, payloads);
+    };
+
+    auto before = count_nodes();
+    tree.collapse();
+    auto after = count_nodes();
+
+    for (size_t i = 0; i < meshes.size(); i += 10) {
+        std::vector<Occl_Mesh *> insides, inters;
+        tree.intersect(&meshes[i], insides, inters);
+
+        size_t expected = 0;
+        for (size_t j = 0; j < meshes.size(); j += 10) {
+            expected += meshes[j].intersect(&meshes[i]);
+        }
+
+        if (insides.size() + inters.size() != expected) {
+            return false;
+        }
+    }
+
+    return after.first < before.first && after.second == before.second && before.second == (meshes.size() + 9) / 10;
+}
+
+// Streams two sectors in, one out and a third into the freed slots.
+bool sector_streaming_matches_brute_force() {
+    Occl_Mesh_Pool pool;
+    std::vector<Occl_Mesh> meshes = random_meshes(pool, 300, 0.3f, 5);
+    Occl_Cull_Context ctx(200 + 100, {{-1, -1}, {1, 1}});
+
+    for (int i = 0; i < 300; i++) {
+        ctx.add_mesh(meshes[i].convex_hull(), (i < 200) ? 1 : 2);
+    }
+
+    ctx.unload_sector(1);
+    bool compacted = ctx.pool.dead_pts == 0 && ctx.free_slots.size() == 200;
+
+    // The lowest slots are handed out first and keep their hulls through the compaction.
+    bool reused = true;
+    for (int i = 0; i < 150; i++) {
+        reused &= ctx.add_mesh(meshes[i].convex_hull(), 3) == i;
+    }
+
+    for (int i = 0; i < 300; i++) {
+        if (ctx.mesh_sectors[i] < 0) continue;
+
+        std::span<const glm::vec2> hull = ctx.meshes[i].convex_hull();
+        reused &= std::equal(hull.begin(), hull.end(), meshes[i].convex_hull().begin(), meshes[i].convex_hull().end());
+    }
+
+    for (int i = 0; i < 300; i++) {
+        if (ctx.mesh_sectors[i] < 0) continue;
+
+        std::vector<Occl_Mesh *> insides, inters;
+        ctx.draw_tree.intersect(&ctx.meshes[i], insides, inters);
+
+        size_t expected = 0;
+        for (int j = 0; j < 300; j++) {
+            expected += ctx.mesh_sectors[j] >= 0 && ctx.meshes[j].intersect(&ctx.meshes[i]);
+        }
+
+        if (insides.size() + inters.size() != expected) {
+            return false;
+        }
+    }
+
+    // Removing everything leaves a bare root, its old children are kept for reuse.
+    for (int sector = 2; sector <= 3; sector++) {
+        ctx.unload_sector(sector);
+    }
+
+    bool emptied = ctx.draw_tree.root->upon_line.empty() && ctx.draw_tree.free_nodes != null
+        && std::all_of(ctx.draw_tree.root->children, ctx.draw_tree.root->children + 4, [](auto *c) { return c == null; });
+
+    return compacted && reused && emptied;
+}
+
+void octree_tests() {
+    begin_test();
+
+    test("lazy triangulation", lazy_triangulation_matches_hull());
+    test("octree depth cap", octree_depth_is_capped());
+    test("sector streaming", sector_streaming_matches_brute_force());
+    test("coverage masks", coverage_masks_are_conservative());
+
+    Occl_Mesh_Pool pool;
+    std::vector<Occl_Mesh> meshes = random_meshes(pool, 500, 0.3f, 1);
+    test("octree intersect, tight", octree_matches_brute_force(meshes, 0.0f));
+    test("octree intersect, loose", octree_matches_brute_force(meshes, 0.5f));
+    test("octree leaf buckets and collapse", bucketed_octree_matches_brute_force(meshes));
+    test("3d broadphase query, tight", broadphase_matches_brute_force(0.0f));
+    test("3d broadphase query, loose", broadphase_matches_brute_force(0.5f));
+
+    end_test();
+}
+
+// Nested scopes come out in order, and once the ring wraps only the latest events are left.
+// Only run if built with OCCL_TRACE, the ring is not compiled in otherwise.
+bool trace_ring_keeps_latest() {
+    std::vector<Occl_Trace_Event> events;
+    occl_trace_clear();
+
+    {
+        Occl_Trace_Scope outer("outer");
+        Occl_Trace_Scope inner("inner", "mesh", 3);
+    }
+
+    occl_trace_events(events);
+    bool nested = events.size() == 4 && events[0].phase == 'B' && events[1].arg == 3 && strcmp(events[2].name, "inner") == 0
+        && events[3].phase == 'E' && events[0].ns <= events[3].ns;
+
+    for (size_t i = 0; i < occl_trace_capacity; i++) {
+        occl_trace_record("filler", 'B');
+    }
+
+    occl_trace_events(events);
+    bool wrapped = events.size() == occl_trace_capacity && strcmp(events[0].name, "filler") == 0;
+
+    occl_trace_clear();
+    return nested && wrapped;
+}
+
+// A static frame keeps every flag, and after moving a few meshes whatever stays hidden is still
+// covered by this frame's occluders.
+bool incremental_view_is_sound() {
+    Occl_Mesh_Pool pool;
+    std::vector<Occl_Mesh> meshes = random_meshes(pool, 300, 0.4f, 6);
+    Occl_Cull_Context ctx(meshes.size(), {{-1, -1}, {1, 1}});
+    ctx.view.incremental = true;
+
+    for (const Occl_Mesh& mesh: meshes) {
+        ctx.add_mesh(mesh.convex_hull());
+    }
+
+    auto cull = [&]() {
+        ctx.begin_frame();
+        for (int i = 0; i < (int)meshes.size(); i++) {
+            if (ctx.get_flags(i) == 0) ctx.flag_mesh(i, Occl_Cull_Flag::OCCLUDED);
+        }
+        ctx.end_frame();
+    };
+
+    cull();
+    Occl_Flag_Bits first_flags = ctx.view.flags;
+    std::vector<int> first_occluders = ctx.view.occluders;
+
+    cull();
+    bool kept = ctx.view.flags == first_flags && ctx.view.occluders == first_occluders
+        && ctx.view.stats.total_cached == (int)meshes.size();
+
+    for (int i = 0; i < (int)meshes.size(); i += 60) {
+        std::vector<glm::vec2> hull(meshes[i].convex_hull().begin(), meshes[i].convex_hull().end());
+        for (glm::vec2& p: hull) p += glm::vec2(0.05f, -0.03f);
+        ctx.update_mesh(i, hull);
+    }
+
+    int cached = ctx.view.stats.total_cached;
+    cull();
+
+    std::vector<int> dirty;
+    ctx.view.dirty.compact(dirty);
+
+    bump_allocator alloc(1024 * 512);
+    Octree<Occl_Mesh *> occluders(&alloc, {{-1, -1}, {1, 1}});
+    for (int i: ctx.view.occluders) {
+        occluders.insert(&ctx.meshes[i]);
+    }
+
+    bool sound = true;
+    for (size_t i = 0; i < meshes.size(); i++) {
+        if (ctx.view.hidden.get(i) && !ctx.meshes[i].inside(occluders)) sound = false;
+    }
+
+    return kept && sound && !dirty.empty() && dirty.size() < meshes.size() / 2
+        && ctx.view.stats.total_cached - cached == (int)(meshes.size() - dirty.size());
+}
+
+// Occluders go first and the rest is only drawn, so nothing but the kept occluders can hide a moved mesh.
+// After moving meshes and an occluder the incremental frame hides the same meshes as a full re-cull.
+bool incremental_view_is_complete() {
+    Occl_Mesh_Pool pool;
+    std::vector<Occl_Mesh> meshes = random_meshes(pool, 200, 0.15f, 8);
+    Occl_Cull_Context ctx(meshes.size() + 4, {{-2, -2}, {2, 2}});
+    ctx.view.incremental = true;
+
+    for (f32 x: {-0.9f, 0.1f}) {
+        for (f32 y: {-0.9f, 0.1f}) {
+            ctx.add_mesh(std::vector<glm::vec2>{{x, y}, {x + 0.8f, y}, {x + 0.8f, y + 0.8f}, {x, y + 0.8f}});
+        }
+    }
+
+    for (const Occl_Mesh& mesh: meshes) {
+        ctx.add_mesh(mesh.convex_hull());
+    }
+
+    auto cull = [&](Occl_Cull_View& view) {
+        view.begin_frame();
+        for (int i = 0; i < (int)ctx.meshes.size(); i++) {
+            if (view.get_flags(i) == 0) view.flag_mesh(i, i < 4 ? Occl_Cull_Flag::OCCLUDED : Occl_Cull_Flag::DRAWN);
+        }
+        view.end_frame();
+    };
+
+    cull(ctx.view);
+
+    for (int i = 4; i < (int)ctx.meshes.size(); i += 25) {
+        std::vector<glm::vec2> hull(ctx.meshes[i].convex_hull().begin(), ctx.meshes[i].convex_hull().end());
+        for (glm::vec2& p: hull) p += glm::vec2(0.3f, 0.2f);
+        ctx.update_mesh(i, hull);
+    }
+
+    ctx.update_mesh(1, std::vector<glm::vec2>{{-0.9f, 0.2f}, {-0.1f, 0.2f}, {-0.1f, 0.9f}, {-0.9f, 0.9f}});
+    cull(ctx.view);
+
+    Occl_Cull_View full(&ctx);
+    cull(full);
+
+    std::vector<int> hidden;
+    full.hidden.compact(hidden);
+    return ctx.view.incremental_frame && ctx.view.hidden == full.hidden && !hidden.empty();
+}
+
+// A bigger occluder submitted later evicts the one it contains from the tree, which still hides the mesh between them.
+bool dominated_occluders_are_evicted() {
+    std::vector<glm::vec2> small = {{-0.1f, -0.1f}, {0.1f, -0.1f}, {0.1f, 0.1f}, {-0.1f, 0.1f}};
+    std::vector<glm::vec2> big = {{-0.5f, -0.5f}, {0.5f, -0.5f}, {0.5f, 0.5f}, {-0.5f, 0.5f}};
+    std::vector<glm::vec2> behind = {{0.2f, 0.2f}, {0.3f, 0.2f}, {0.3f, 0.3f}};
+
+    Occl_Cull_Context ctx(3, {{-1, -1}, {1, 1}});
+    ctx.add_mesh(small);
+    ctx.add_mesh(big);
+    ctx.add_mesh(behind);
+
+    ctx.begin_frame();
+    ctx.flag_mesh(0, Occl_Cull_Flag::OCCLUDED);
+    ctx.flag_mesh(1, Occl_Cull_Flag::OCCLUDED);
+
+    size_t payloads = 0;
+    ctx.view.occluded_tree.for_each_node([&](const Octree<Occl_Mesh *>::Octree_Node *node, int) { payloads += node->upon_line.size(); });
+
+    return payloads == 1 && ctx.view.occluders.size() == 2 && ctx.view.stats.total_evicted == 1 && ctx.view.hidden.get(2);
+}
+
+// Culls the meshes in the given order on a fresh context and on a view of the shared one.
+bool view_matches_context(Occl_Cull_Context& shared, const std::vector<int>& order) {
+    Occl_Cull_Context ctx(shared.meshes.size(), shared.draw_tree.root->bbox);
+    for (const Occl_Mesh& mesh: shared.meshes) {
+        ctx.add_mesh(mesh.convex_hull());
+    }
+
+    Occl_Cull_View view(&shared);
+
+    for (int frame = 0; frame < 2; frame++) {
+        ctx.begin_frame();
+        view.begin_frame();
+
+        for (int i: order) {
+            if (ctx.get_flags(i) == 0) ctx.flag_mesh(i, Occl_Cull_Flag::OCCLUDED);
+            if (view.get_flags(i) == 0) view.flag_mesh(i, Occl_Cull_Flag::OCCLUDED);
+        }
+
+        for (size_t i = 0; i < shared.meshes.size(); i++) {
+            if (ctx.get_flags(i) != view.get_flags(i)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void cull_view_tests() {
+    begin_test();
+
+    Occl_Mesh_Pool pool;
+    std::vector<Occl_Mesh> meshes = random_meshes(pool, 300, 0.4f, 3);
+    Occl_Cull_Context shared(meshes.size(), {{-1, -1}, {1, 1}});
+    for (const Occl_Mesh& mesh: meshes) {
+        shared.add_mesh(mesh.convex_hull());
+    }
+
+    std::vector<int> forward, backward;
+    for (int i = 0; i < (int)meshes.size(); i++) {
+        forward.push_back(i);
+        backward.push_back((int)meshes.size() - 1 - i);
+    }
+
+    test("cull view, forward order", view_matches_context(shared, forward));
+    test("cull view, backward order", view_matches_context(shared, backward));
+
+    // The scene is static, so the seeds of the second frame decide the same flags up front.
+    Occl_Cull_View view(&shared);
+    view.temporal = true;
+    Occl_Flag_Bits first_flags;
+
+    for (int frame = 0; frame < 2; frame++) {
+        view.begin_frame();
+        for (int i: forward) {
+            if (view.get_flags(i) == 0) view.flag_mesh(i, Occl_Cull_Flag::OCCLUDED);
+        }
+        view.end_frame();
+
+        if (frame == 0) first_flags = view.flags;
+    }
+
+    test("temporal view, same flags", view.flags == first_flags);
+    test("temporal view, seeded", view.stats.total_seeded > 0 && view.stats.total_revived == 0);
+
+    // Submitting only every other occluder must not leave anything occluded by the others.
+    view.begin_frame();
+    for (size_t k = 0; k < view.last_occluders.size(); k += 2) {
+        int i = view.last_occluders[k];
+        if (view.get_flags(i) == 0) view.flag_mesh(i, Occl_Cull_Flag::OCCLUDED);
+    }
+    view.end_frame();
+
+    bump_allocator alloc(1024 * 512);
+    Octree<Occl_Mesh *> submitted(&alloc, {{-1, -1}, {1, 1}});
+    for (int i: view.occluders) {
+        if (view.seeds[i] != Occl_Cull_View::SEED_UNCONFIRMED) submitted.insert(&shared.meshes[i]);
+    }
+
+    bool sound = true;
+    for (size_t i = 0; i < shared.meshes.size(); i++) {
+        bool occluder = std::find(view.occluders.begin(), view.occluders.end(), (int)i) != view.occluders.end();
+        if (!occluder && (view.flags.get(i) & (u8)Occl_Cull_Flag::OCCLUDED) && !shared.meshes[i].inside(submitted)) {
+            sound = false;
+        }
+    }
+
+    // A candidate only a stale seed covered gets into the tree once the seed turns out unsubmitted.
+    // Tiny meshes count as inside even an empty tree, so one that is not is picked.
+    std::vector<int> stale_hidden;
+    view.hidden_indices(stale_hidden);
+    bump_allocator empty_alloc(1024);
+    Octree<Occl_Mesh *> empty(&empty_alloc, {{-1, -1}, {1, 1}});
+
+    int revived = -1;
+    for (int i: stale_hidden) {
+        if (revived < 0 && !shared.meshes[i].inside(empty)) revived = i;
+    }
+
+    view.begin_frame();
+    if (revived >= 0) view.flag_mesh(revived, Occl_Cull_Flag::OCCLUDED);
+    view.end_frame();
+
+    bool inserted = revived >= 0 && !view.hidden.get(revived) && view.seeds[revived] == 0
+        && std::find(view.occluders.begin(), view.occluders.end(), revived) != view.occluders.end()
+        && shared.meshes[revived].inside(view.occluded_tree);
+
+    test("temporal view, stale seeds", sound && inserted);
+
+    // The index lists match a plain scan, and an empty frame reveals everything hidden before.
+    Occl_Cull_View diff_view(&shared);
+    std::vector<int> hidden, flagged, scanned, no_longer_hidden, newly_hidden;
+
+    diff_view.begin_frame();
+    for (int i: forward) {
+        if (diff_view.get_flags(i) == 0) diff_view.flag_mesh(i, Occl_Cull_Flag::OCCLUDED);
+    }
+
+    diff_view.hidden_indices(hidden);
+    diff_view.flagged_indices(Occl_Cull_Flag::OCCLUDED, flagged);
+    for (int i: forward) {
+        if (diff_view.get_flags(i) & (u8)Occl_Cull_Flag::OCCLUDED) scanned.push_back(i);
+    }
+
+    diff_view.begin_frame();
+    diff_view.frame_diff(no_longer_hidden, newly_hidden);
+
+    test("bitset flags, index lists and frame diff", !hidden.empty() && flagged == scanned && hidden.size() < flagged.size()
+        && no_longer_hidden == hidden && newly_hidden.empty());
+
+    Occl_Cull_View budget_view(&shared);
+    budget_view.occluder_budget = 5;
+    budget_view.begin_frame();
+    budget_view.select_occluders(forward);
+
+    for (int i: forward) {
+        if (budget_view.get_flags(i) == 0) budget_view.flag_mesh(i, Occl_Cull_Flag::OCCLUDED);
+    }
+
+    int best = 0;
+    for (int i: forward) {
+        if (budget_view.occluder_score(i) > budget_view.occluder_score(best)) best = i;
+    }
+
+    // Covering a triangle by two halves of a square needs more than one subtraction.
+    std::vector<triangle> square = {{{{0, 0}, {1, 0}, {1, 1}}}, {{{0, 0}, {1, 1}, {0, 1}}}};
+    triangle inner = {{{0.2f, 0.1f}, {0.9f, 0.5f}, {0.1f, 0.8f}}};
+    Occl_Work_Budget tight(1, 0), unlimited(0, 0);
+    test("work budget", tri_in_mesh(inner, square, 1e-3f, &unlimited) && !tri_in_mesh(inner, square, 1e-3f, &tight));
+
+    // A square cut into four triangles around its center merges back into two, the one apart stays.
+    std::vector<triangle> fragments = {
+        {{{0.5f, 0.5f}, {0, 0}, {1, 0}}}, {{{0.5f, 0.5f}, {1, 0}, {1, 1}}},
+        {{{0.5f, 0.5f}, {1, 1}, {0, 1}}}, {{{0.5f, 0.5f}, {0, 1}, {0, 0}}},
+        {{{2, 2}, {3, 2}, {3, 3}}}
+    };
+    merge_remainders(fragments);
+
+    f32 merged_area = 0.0f;
+    for (const triangle& tri: fragments) merged_area += tri_area(tri);
+    test("remainder merging", fragments.size() == 3 && f32_eq(merged_area, 1.5f));
+
+    // A square with a slightly sagging bottom, cut into a fan from its top left corner. The merged
+    // polygon must not be fanned from a bottom point, subtract_triangles would drop those slivers.
+    std::vector<glm::vec2> bottom;
+    for (int i = 0; i <= 8; i++) {
+        f32 x = i / 8.0f;
+        bottom.push_back({x, -0.01f * x * (1.0f - x)});
+    }
+
+    glm::vec2 tl = {0, 1}, tr = {1, 1}, mid = {1, 0.5f};
+    fragments = {{{tl, bottom[8], mid}}, {{tl, mid, tr}}};
+    for (int i = 0; i < 8; i++) fragments.push_back({{tl, bottom[i], bottom[i + 1]}});
+
+    f32 fan_area = 0.0f;
+    for (const triangle& tri: fragments) fan_area += tri_area(tri);
+    merge_remainders(fragments);
+
+    bool no_slivers = true;
+    merged_area = 0.0f;
+    for (const triangle& tri: fragments) {
+        merged_area += tri_area(tri);
+        no_slivers &= tri_min_height_to_ground_ratio(tri) >= 1e-2f;
+    }
+
+    test("remainder merging, many points", fragments.size() == 9 && no_slivers && f32_eq(merged_area, fan_area));
+
+    test("occluder budget", budget_view.occluders.size() <= 5 && budget_view.selected[best] && budget_view.stats.total_unselected > 0);
+    if (OCCL_TRACE) test("trace ring buffer", trace_ring_keeps_latest());
+    test("incremental view", incremental_view_is_sound());
+    test("incremental view, complete", incremental_view_is_complete());
+    test("occluder eviction", dominated_occluders_are_evicted());
+
+    end_test();
+}
+
+void tiled_cull_tests() {
+    begin_test();
+
+    Occl_Mesh_Pool pool;
+    std::vector<Occl_Mesh> meshes = random_meshes(pool, 300, 0.4f, 4);
+    Occl_Cull_Context ctx(meshes.size(), {{-2, -2}, {2, 2}});
+    for (const Occl_Mesh& mesh: meshes) {
+        ctx.add_mesh(mesh.convex_hull());
+    }
+
+    std::vector<int> order;
+    for (int i = 0; i < (int)meshes.size(); i++) {
+        if (ctx.get_flags(i) == 0) ctx.flag_mesh(i, Occl_Cull_Flag::OCCLUDED);
+        order.push_back(i);
+    }
+
+    // A single tile covers the whole clip box, so it must agree with a plain view.
+    Occl_Tiled_Cull single(&ctx, 1, 1);
+    single.cull(order, 1);
+    test("tiled cull, one tile", single.hidden == ctx.view.hidden);
+
+    // Tiles only see part of the occluders of a mesh, so they may hide less but never more.
+    Occl_Tiled_Cull serial(&ctx, 4, 4), parallel(&ctx, 4, 4);
+    serial.cull(order, 1);
+    parallel.cull(order, 4);
+
+    std::vector<int> tiled_hidden;
+    serial.hidden_indices(tiled_hidden);
+    bool subset = !tiled_hidden.empty();
+    for (int i: tiled_hidden) {
+        if (!ctx.view.hidden.get(i)) subset = false;
+    }
+
+    test("tiled cull, hides a subset", subset);
+    test("tiled cull, workers agree", serial.hidden == parallel.hidden);
+
+    end_test();
+}
+
+// Applies every record of the capture to ctx, false if it stops before the end.
+bool replay_capture(Occl_Capture_Reader& reader, Occl_Cull_Context& ctx) {
+    Occl_Capture_Record record;
+
+    reader.rewind();
+    while (reader.next(record)) {
+        switch (record.tag) {
+            case Occl_Capture_Tag::ADD_MESH:
+            case Occl_Capture_Tag::ADD_SECTOR_MESH: ctx.add_mesh(record.convex_hull, record.sector); break;
+            case Occl_Capture_Tag::UNLOAD_SECTOR: ctx.unload_sector(record.sector); break;
+            case Occl_Capture_Tag::UPDATE_MESH: ctx.update_mesh(record.index, record.convex_hull); break;
+            case Occl_Capture_Tag::MARK_DIRTY: ctx.mark_dirty(record.bbox); break;
+            case Occl_Capture_Tag::FLAG_MESH: ctx.flag_mesh(record.index, record.flag); break;
+            case Occl_Capture_Tag::BEGIN_FRAME: ctx.begin_frame(); break;
+            case Occl_Capture_Tag::END_FRAME: ctx.end_frame(); break;
+            case Occl_Capture_Tag::SELECT_OCCLUDERS:
+                ctx.view.occluder_budget = record.budget;
+                ctx.select_occluders(record.candidates);
+                break;
+        }
+    }
+
+    return reader.cursor == reader.size;
+}
+
+// Two frames with a moved mesh and an occluder budget are written, mapped back in and replayed
+// against a fresh context, which has to end up with the same flags. A cut off copy stops early.
+void capture_tests() {
+    begin_test();
+
+    const char *path = "bin/test_capture.bin";
+    const char *truncated_path = "bin/test_capture_truncated.bin";
+
+    Occl_Mesh_Pool pool;
+    std::vector<Occl_Mesh> meshes = random_meshes(pool, 200, 0.4f, 9);
+    Occl_Cull_Context live(meshes.size(), {{-2, -2}, {2, 2}});
+    for (size_t i = 0; i < meshes.size() / 2; i++) {
+        live.add_mesh(meshes[i].convex_hull());
+    }
+
+    bool started = live.start_capture(path);
+    for (size_t i = meshes.size() / 2; i < meshes.size(); i++) {
+        live.add_mesh(meshes[i].convex_hull(), 1);
+    }
+
+    std::vector<int> all;
+    for (int i = 0; i < (int)meshes.size(); i++) all.push_back(i);
+
+    for (int frame = 0; frame < 2; frame++) {
+        live.begin_frame();
+        live.view.occluder_budget = 20;
+        live.select_occluders(all);
+        for (int i: all) {
+            if (live.get_flags(i) == 0) live.flag_mesh(i, Occl_Cull_Flag::OCCLUDED);
+        }
+        live.end_frame();
+
+        std::vector<glm::vec2> hull(meshes[frame].convex_hull().begin(), meshes[frame].convex_hull().end());
+        for (glm::vec2& p: hull) p += glm::vec2(0.1f, 0.1f);
+        live.update_mesh(frame, hull);
+        live.mark_dirty({{-0.1f, -0.1f}, {0.1f, 0.1f}});
+    }
+
+    live.stop_capture();
+
+    Occl_Capture_Reader reader;
+    bool opened = started && reader.open(path);
+    Occl_Cull_Context replayed(opened ? reader.reserve : 0, reader.clip_box);
+    bool complete = opened && replay_capture(reader, replayed);
+
+    test("capture round trip", complete && replayed.meshes.size() == live.meshes.size()
+        && replayed.view.flags == live.view.flags && replayed.view.hidden == live.view.hidden);
+
+    // Cut into the last record, the final mark_dirty.
+    FILE *file = opened ? fopen(truncated_path, "wb") : null;
+    if (file != null) {
+        fwrite(reader.data, 1, reader.size - 2, file);
+        fclose(file);
+    }
+
+    Occl_Capture_Reader truncated;
+    Occl_Cull_Context partial(meshes.size(), {{-2, -2}, {2, 2}});
+    bool stopped = file != null && truncated.open(truncated_path) && !replay_capture(truncated, partial)
+        && truncated.cursor < truncated.size;
+
+    test("capture truncated", stopped);
+
+    remove(path);
+    remove(truncated_path);
+    end_test();
+}
+
 void convex_hull_tests() {
     std::vector<glm::vec2> pts = {{0, 0}, {1, 0}, {1, 1}, {0, 1}, {0.5f, 0.5f}};
     inplace_convex_hull(pts);
@@ -417,6 +1196,10 @@ void convex_hull_tests() {
 
 int main() {
     triangle_boolean_tests();
+    octree_tests();
+    cull_view_tests();
+    tiled_cull_tests();
+    capture_tests();
     convex_hull_tests();
     return 0;
 }
\ No newline at end of file
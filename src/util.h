@@ -10,6 +10,8 @@ using u8 = unsigned char;
 using u16 = unsigned short;
 using u32 = unsigned int;
 using u64 = unsigned long int;
+using i32 = int;
+using i64 = long int;
 using f32 = float;
 
 #define F32_INF (f32)(1.0f / 0.0f)
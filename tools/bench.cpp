@@ -0,0 +1,501 @@
+#include "../src/occl_cull.h"
+#include "../src/algorithm.h"
+#include "../src/occl_tiled.h"
+#include "bench_util.h"
+#include <glm/vec2.hpp>
+#include <random>
+#include <thread>
+#include <cmath>
+
+// Micro-benchmarks for the hot kernels. Every benchmark is seeded, so two
+// runs on the same machine measure the same inputs.
+
+// Keeps the optimizer from removing benchmarked calls whose results are unused.
+volatile size_t bench_sink;
+
+std::mt19937 rng(0x5eed);
+
+f32 rand_f32(f32 lo, f32 hi) {
+    return std::uniform_real_distribution<f32>(lo, hi)(rng);
+}
+
+glm::vec2 rand_pt(f32 lo, f32 hi) {
+    return {rand_f32(lo, hi), rand_f32(lo, hi)};
+}
+
+triangle make_cc(triangle tri) {
+    if (!tri_is_winding_cc(tri)) {
+        std::swap(tri.pts[1], tri.pts[2]);
+    }
+
+    return tri;
+}
+
+triangle rand_tri(f32 lo, f32 hi) {
+    for (;;) {
+        triangle tri = make_cc({{rand_pt(lo, hi), rand_pt(lo, hi), rand_pt(lo, hi)}});
+        if (tri_area(tri) > 1e-3f * (hi - lo) * (hi - lo)) return tri;
+    }
+}
+
+std::vector<std::pair<triangle, triangle>> gen_random_pairs(size_t count) {
+    std::vector<std::pair<triangle, triangle>> pairs;
+
+    for (size_t i = 0; i < count; i++) {
+        pairs.push_back({rand_tri(0, 4), rand_tri(0, 4)});
+    }
+
+    return pairs;
+}
+
+// Degenerate configurations the subtraction has to special case: shared
+// corners, shared and collinear sides, containment and slivers.
+std::vector<std::pair<triangle, triangle>> gen_adversarial_pairs(size_t count) {
+    std::vector<std::pair<triangle, triangle>> pairs;
+
+    for (size_t i = 0; i < count; i++) {
+        triangle a = rand_tri(0, 4);
+        triangle b;
+
+        switch (i % 6) {
+            case 0: b = a; break;
+            case 1: b = make_cc({{a.pts[0], a.pts[1], rand_pt(0, 4)}}); break;
+            case 2: b = make_cc({{a.pts[0], rand_pt(0, 4), rand_pt(0, 4)}}); break;
+            case 3: {
+                glm::vec2 c = (a.pts[0] + a.pts[1] + a.pts[2]) * (1.0f / 3.0f);
+                b = {{c + 2.0f * (a.pts[0] - c), c + 2.0f * (a.pts[1] - c), c + 2.0f * (a.pts[2] - c)}};
+                std::swap(a, b);
+            } break;
+            case 4: {
+                glm::vec2 d = a.pts[1] - a.pts[0];
+                b = make_cc({{a.pts[0] - 0.5f * d, a.pts[1] + 0.5f * d, rand_pt(0, 4)}});
+            } break;
+            case 5: {
+                glm::vec2 d = a.pts[1] - a.pts[0];
+                b = make_cc({{a.pts[0], a.pts[1], a.pts[0] + 0.5f * d + 1e-3f * glm::vec2(-d.y, d.x)}});
+            } break;
+        }
+
+        pairs.push_back({a, b});
+    }
+
+    return pairs;
+}
+
+std::vector<glm::vec2> gen_hull(glm::vec2 center, f32 radius, int count) {
+    std::vector<glm::vec2> pts;
+
+    for (int i = 0; i < count; i++) {
+        pts.push_back(center + rand_pt(-radius, radius));
+    }
+
+    inplace_convex_hull(pts);
+    return pts;
+}
+
+std::vector<triangle> hull_to_tris(const std::vector<glm::vec2>& hull) {
+    std::vector<triangle> tris;
+
+    for (size_t i = 2; i < hull.size(); i++) {
+        tris.push_back(make_cc({{hull[i - 1], hull[i], hull[0]}}));
+    }
+
+    return tris;
+}
+
+// Meshes with a few large occluders and many small occludees, as in a level.
+std::vector<std::vector<glm::vec2>> gen_scene(const BBox& clip_box, size_t count) {
+    std::vector<std::vector<glm::vec2>> hulls;
+    glm::vec2 size = clip_box.br - clip_box.tl;
+
+    for (size_t i = 0; i < count; i++) {
+        f32 radius = (i % 10 == 0) ? rand_f32(0.1f, 0.3f) : rand_f32(0.005f, 0.05f);
+        glm::vec2 center = clip_box.tl + glm::vec2(rand_f32(radius, 1 - radius) * size.x, rand_f32(radius, 1 - radius) * size.y);
+        hulls.push_back(gen_hull(center, radius * std::min(size.x, size.y), 8));
+    }
+
+    return hulls;
+}
+
+bench_result bench_subtract(const std::string& name, const std::vector<std::pair<triangle, triangle>>& pairs) {
+    bench_timer timer;
+    std::vector<triangle> out;
+
+    for (const auto& [minuend, subtr]: pairs) {
+        out.clear();
+        timer.begin();
+        subtract_triangles(minuend, subtr, out);
+        timer.end();
+        bench_sink = out.size();
+    }
+
+    return summarize(name, timer);
+}
+
+// Same as above, with the subtrahends prepared up front as tri_in_mesh does.
+bench_result bench_subtract_prepared(const std::string& name, const std::vector<std::pair<triangle, triangle>>& pairs) {
+    bench_timer timer;
+    std::vector<triangle> out;
+    std::vector<prepared_triangle> prepared;
+
+    for (const auto& pair: pairs) {
+        prepared.push_back(prepare_triangle(pair.second));
+    }
+
+    for (size_t i = 0; i < pairs.size(); i++) {
+        out.clear();
+        timer.begin();
+        subtract_triangles(pairs[i].first, prepared[i], out);
+        timer.end();
+        bench_sink = out.size();
+    }
+
+    return summarize(name, timer);
+}
+
+bench_result bench_tri_in_mesh(const std::string& name, size_t count, int hull_pts) {
+    bench_timer timer;
+
+    for (size_t i = 0; i < count; i++) {
+        std::vector<triangle> occluder = hull_to_tris(gen_hull({2, 2}, rand_f32(1.0f, 2.0f), hull_pts));
+        triangle occludee = rand_tri(1, 3);
+
+        timer.begin();
+        bool inside = tri_in_mesh(occludee, occluder);
+        timer.end();
+        bench_sink = inside;
+    }
+
+    return summarize(name, timer);
+}
+
+// Builds the list of hidden meshes of a frame, either by compacting the bitset or by
+// scanning a byte per mesh as get_flags callers do. One sample covers all meshes.
+bench_result bench_hidden_list(const std::string& name, size_t count, f32 hidden_ratio, bool compact) {
+    bench_timer timer;
+    rng.seed(0x5eed);
+
+    Occl_Bitset hidden;
+    std::vector<u8> bytes(count, 0);
+    hidden.assign(count);
+
+    for (size_t i = 0; i < count; i++) {
+        if (rand_f32(0, 1) < hidden_ratio) {
+            hidden.set(i);
+            bytes[i] = 1;
+        }
+    }
+
+    std::vector<int> indices;
+    indices.reserve(count);
+
+    for (int k = 0; k < 200; k++) {
+        indices.clear();
+        timer.begin();
+
+        if (compact) {
+            hidden.compact(indices);
+        } else {
+            for (size_t i = 0; i < count; i++) {
+                if (bytes[i]) indices.push_back((int)i);
+            }
+        }
+
+        timer.end();
+        bench_sink = indices.size();
+    }
+
+    return summarize(name, timer);
+}
+
+bench_result bench_convex_hull(const std::string& name, size_t count, int pts_count, bool on_circle) {
+    bench_timer timer;
+
+    for (size_t i = 0; i < count; i++) {
+        std::vector<glm::vec2> pts;
+
+        for (int j = 0; j < pts_count; j++) {
+            if (on_circle) {
+                f32 a = rand_f32(0.0f, 6.2831853f);
+                pts.push_back({std::cos(a), std::sin(a)});
+            } else {
+                pts.push_back(rand_pt(-1, 1));
+            }
+        }
+
+        timer.begin();
+        inplace_convex_hull(pts);
+        timer.end();
+        bench_sink = pts.size();
+    }
+
+    return summarize(name, timer);
+}
+
+void bench_octree(const std::string& name, size_t count, f32 looseness, std::vector<bench_result>& results, size_t leaf_capacity = 0) {
+    BBox clip_box = {{-1, -1}, {1, 1}};
+    std::vector<std::vector<glm::vec2>> hulls = gen_scene(clip_box, count);
+
+    Occl_Mesh_Pool pool;
+    std::vector<Occl_Mesh> meshes;
+    meshes.reserve(hulls.size());
+    for (const auto& hull: hulls) {
+        meshes.push_back(pool.add(hull));
+    }
+
+    bump_allocator alloc(1024 * 1024 * 16);
+    Octree<Occl_Mesh *> tree(&alloc, clip_box, looseness);
+    tree.leaf_capacity = leaf_capacity;
+
+    bench_timer insert_timer;
+    for (Occl_Mesh& mesh: meshes) {
+        insert_timer.begin();
+        tree.insert(&mesh);
+        insert_timer.end();
+    }
+
+    bench_timer intersect_timer;
+    std::vector<Occl_Mesh *> insides, inters;
+    for (Occl_Mesh& mesh: meshes) {
+        insides.clear();
+        inters.clear();
+
+        intersect_timer.begin();
+        tree.intersect(&mesh, insides, inters);
+        intersect_timer.end();
+        bench_sink = insides.size() + inters.size();
+    }
+
+    results.push_back(summarize(name + "_insert", insert_timer));
+    results.push_back(summarize(name + "_intersect", intersect_timer));
+}
+
+bench_result bench_flag_mesh(const std::string& name, size_t count, size_t frames, f32 looseness) {
+    BBox clip_box = {{-1, -1}, {1, 1}};
+    bench_timer timer;
+
+    for (size_t f = 0; f < frames; f++) {
+        std::vector<std::vector<glm::vec2>> hulls = gen_scene(clip_box, count);
+        Occl_Cull_Context ctx(hulls.size(), clip_box, looseness);
+
+        for (const auto& hull: hulls) {
+            ctx.add_mesh(hull);
+        }
+
+        // The generator emits large occluders every tenth mesh, so flag those
+        // first to emulate a rough front-to-back submission order.
+        std::vector<int> order;
+        for (size_t i = 0; i < hulls.size(); i += 10) order.push_back((int)i);
+        for (size_t i = 0; i < hulls.size(); i++) if (i % 10 != 0) order.push_back((int)i);
+
+        for (int i: order) {
+            if (ctx.get_flags(i) != 0) continue;
+
+            timer.begin();
+            ctx.flag_mesh(i, Occl_Cull_Flag::OCCLUDED);
+            timer.end();
+        }
+
+        bench_sink = ctx.snapshot_stats().total_occluded;
+    }
+
+    return summarize(name, timer);
+}
+
+// The order of view v rotates the occluders, so every view ends up with a different occluder set.
+std::vector<int> view_order(size_t count, int v) {
+    std::vector<int> order;
+    for (size_t i = 0; i < count; i += 10) order.push_back((int)((i + 10 * v) % count));
+    for (size_t i = 0; i < count; i++) if (i % 10 != 0) order.push_back((int)i);
+    return order;
+}
+
+template<typename T>
+void cull_in_order(T& target, const std::vector<int>& order) {
+    for (int i: order) {
+        if (target.get_flags(i) != 0) continue;
+        target.flag_mesh(i, Occl_Cull_Flag::OCCLUDED);
+    }
+}
+
+// Culls the same scene for several frames, so a temporal view can reuse the last frame's occluders.
+bench_result bench_frames(const std::string& name, size_t count, size_t frames, bool temporal, int budget = 0, u64 max_subtractions = 0) {
+    BBox clip_box = {{-1, -1}, {1, 1}};
+    bench_timer timer;
+    rng.seed(0x5eed);
+
+    std::vector<std::vector<glm::vec2>> hulls = gen_scene(clip_box, count);
+    Occl_Cull_Context ctx(hulls.size(), clip_box);
+    ctx.view.temporal = temporal;
+    ctx.view.occluder_budget = budget;
+    ctx.slow_path.max_subtractions = max_subtractions;
+
+    std::vector<int> candidates;
+    for (size_t i = 0; i < hulls.size(); i++) candidates.push_back((int)i);
+
+    for (const auto& hull: hulls) {
+        ctx.add_mesh(hull);
+    }
+
+    for (size_t f = 0; f < frames; f++) {
+        timer.begin();
+        ctx.begin_frame();
+        ctx.select_occluders(candidates);
+        cull_in_order(ctx, view_order(hulls.size(), 0));
+        ctx.end_frame();
+        timer.end();
+    }
+
+    bench_sink = ctx.snapshot_stats().total_occluded;
+    return summarize(name, timer);
+}
+
+// Moves a few meshes back and forth between frames, as with doors and props in a static level.
+bench_result bench_moving(const std::string& name, size_t count, size_t frames, size_t moved, bool incremental) {
+    BBox clip_box = {{-1, -1}, {1, 1}};
+    bench_timer timer;
+    rng.seed(0x5eed);
+
+    std::vector<std::vector<glm::vec2>> hulls = gen_scene(clip_box, count);
+    Occl_Cull_Context ctx(hulls.size(), clip_box);
+    ctx.view.incremental = incremental;
+
+    for (const auto& hull: hulls) {
+        ctx.add_mesh(hull);
+    }
+
+    std::vector<int> order = view_order(hulls.size(), 0);
+    cull_in_order(ctx, order);
+
+    for (size_t f = 0; f < frames; f++) {
+        glm::vec2 offset = (f % 2 == 0) ? glm::vec2(0.01f, 0.0f) : glm::vec2(0.0f);
+
+        timer.begin();
+        // Every tenth mesh is a large occluder, the ones after them are small props.
+        for (size_t k = 0; k < moved; k++) {
+            int i = (int)(k * hulls.size() / moved) + 1;
+            std::vector<glm::vec2> hull = hulls[i];
+            for (glm::vec2& p: hull) p += offset;
+            ctx.update_mesh(i, hull);
+        }
+
+        ctx.begin_frame();
+        cull_in_order(ctx, order);
+        ctx.end_frame();
+        timer.end();
+    }
+
+    bench_sink = ctx.snapshot_stats().total_occluded;
+    return summarize(name, timer);
+}
+
+// Culls several views of one scene, either with a full context per view or with
+// views sharing one draw tree that run on their own threads.
+bench_result bench_views(const std::string& name, size_t count, size_t frames, int view_count, bool shared) {
+    BBox clip_box = {{-1, -1}, {1, 1}};
+    bench_timer timer;
+    rng.seed(0x5eed); // Both variants cull the same scenes.
+
+    for (size_t f = 0; f < frames; f++) {
+        std::vector<std::vector<glm::vec2>> hulls = gen_scene(clip_box, count);
+
+        timer.begin();
+
+        if (shared) {
+            Occl_Cull_Context ctx(hulls.size(), clip_box);
+            for (const auto& hull: hulls) {
+                ctx.add_mesh(hull);
+            }
+
+            std::vector<Occl_Cull_View *> views;
+            std::vector<std::thread> threads;
+            for (int v = 0; v < view_count; v++) {
+                // By value, views grows while the threads run.
+                Occl_Cull_View *view = new Occl_Cull_View(&ctx);
+                views.push_back(view);
+                threads.emplace_back([&hulls, view, v]() { cull_in_order(*view, view_order(hulls.size(), v)); });
+            }
+
+            for (std::thread& thread: threads) thread.join();
+            for (Occl_Cull_View *view: views) {
+                bench_sink = view->stats.total_occluded;
+                delete view;
+            }
+        } else {
+            for (int v = 0; v < view_count; v++) {
+                Occl_Cull_Context ctx(hulls.size(), clip_box);
+                for (const auto& hull: hulls) {
+                    ctx.add_mesh(hull);
+                }
+
+                cull_in_order(ctx, view_order(hulls.size(), v));
+                bench_sink = ctx.snapshot_stats().total_occluded;
+            }
+        }
+
+        timer.end();
+    }
+
+    return summarize(name, timer);
+}
+
+bench_result bench_tiled(const std::string& name, size_t count, size_t frames, int tiles, int thread_count) {
+    BBox clip_box = {{-1, -1}, {1, 1}};
+    bench_timer timer;
+    rng.seed(0x5eed);
+
+    std::vector<std::vector<glm::vec2>> hulls = gen_scene(clip_box, count);
+    Occl_Cull_Context ctx(hulls.size(), clip_box);
+
+    for (const auto& hull: hulls) {
+        ctx.add_mesh(hull);
+    }
+
+    std::vector<int> order = view_order(hulls.size(), 0);
+    Occl_Tiled_Cull tiled(&ctx, tiles, tiles);
+
+    for (size_t f = 0; f < frames; f++) {
+        timer.begin();
+        tiled.cull(order, thread_count);
+        timer.end();
+    }
+
+    bench_sink = tiled.stats.total_occluded;
+    return summarize(name, timer);
+}
+
+int main(int argc, char **argv) {
+    const char *out_path = (argc > 1) ? argv[1] : "bin/bench.json";
+
+    std::vector<bench_result> results;
+    results.push_back(bench_subtract("subtract_triangles_random", gen_random_pairs(20000)));
+    results.push_back(bench_subtract("subtract_triangles_adversarial", gen_adversarial_pairs(20000)));
+    results.push_back(bench_subtract_prepared("subtract_triangles_prepared", gen_random_pairs(20000)));
+    results.push_back(bench_tri_in_mesh("tri_in_mesh", 2000, 12));
+    // Many thin fan triangles cut the remainders up the most.
+    results.push_back(bench_tri_in_mesh("tri_in_mesh_64_pts", 500, 64));
+    results.push_back(bench_convex_hull("convex_hull_cloud_64", 5000, 64, false));
+    results.push_back(bench_convex_hull("convex_hull_circle_64", 5000, 64, true));
+    results.push_back(bench_hidden_list("hidden_list_scan_100k", 100000, 0.1f, false));
+    results.push_back(bench_hidden_list("hidden_list_compact_100k", 100000, 0.1f, true));
+    bench_octree("octree", 5000, 0.0f, results);
+    bench_octree("octree_loose", 5000, 0.5f, results);
+    bench_octree("octree_buckets_8", 5000, 0.0f, results, 8);
+    results.push_back(bench_flag_mesh("flag_mesh", 2000, 5, 0.0f));
+    results.push_back(bench_flag_mesh("flag_mesh_loose", 2000, 5, 0.5f));
+    results.push_back(bench_frames("frames_10", 1000, 10, false));
+    results.push_back(bench_frames("frames_10_temporal", 1000, 10, true));
+    results.push_back(bench_frames("frames_10_budget_50", 1000, 10, false, 50));
+    results.push_back(bench_frames("frames_10_max_256_subtractions", 1000, 10, false, 0, 256));
+    results.push_back(bench_moving("moving_10_full", 1000, 10, 10, false));
+    results.push_back(bench_moving("moving_10_incremental", 1000, 10, 10, true));
+    results.push_back(bench_tiled("tiled_1x1", 1000, 5, 1, 1));
+    results.push_back(bench_tiled("tiled_4x4", 1000, 5, 4, 1));
+    results.push_back(bench_tiled("tiled_4x4_16_threads", 1000, 5, 4, 16));
+    results.push_back(bench_views("views_5_separate", 1000, 3, 5, false));
+    results.push_back(bench_views("views_5_shared", 1000, 3, 5, true));
+
+    // The subtraction logs its failures to stdout, so the JSON only goes to the file.
+    print(results);
+    return write_json(out_path, results) ? 0 : 1;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include "../src/util.h"
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+// Timing and reporting shared by the benchmark and replay tools.
+
+using bench_clock = std::chrono::steady_clock;
+
+struct bench_result {
+    std::string name;
+    size_t ops;
+    double total_ns;
+    double p50_ns, p90_ns, p99_ns, max_ns;
+};
+
+inline double ns_since(bench_clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+}
+
+struct bench_timer {
+    std::vector<double> samples;
+    bench_clock::time_point start;
+
+    inline void begin() {
+        start = bench_clock::now();
+    }
+
+    inline void end() {
+        samples.push_back(ns_since(start));
+    }
+};
+
+inline double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0.0;
+
+    size_t idx = (size_t)std::ceil(p * (double)sorted.size()) - 1;
+    return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+inline bench_result summarize(const std::string& name, bench_timer& timer) {
+    std::vector<double>& s = timer.samples;
+    std::sort(s.begin(), s.end());
+
+    double total = 0.0;
+    for (double v: s) total += v;
+
+    return {name, s.size(), total, percentile(s, 0.5), percentile(s, 0.9), percentile(s, 0.99), s.empty() ? 0.0 : s.back()};
+}
+
+inline void print(const std::vector<bench_result>& results) {
+    for (const bench_result& r: results) {
+        printf("%-32s %8zu ops  p50 %10.1f ns  p99 %10.1f ns\n", r.name.c_str(), r.ops, r.p50_ns, r.p99_ns);
+    }
+}
+
+inline bool write_json(const char *path, const std::vector<bench_result>& results) {
+    FILE *file = fopen(path, "w");
+    if (file == null) {
+        print_error("Failed to open '%s' for writing.\n", path);
+        return false;
+    }
+
+    fprintf(file, "{\n  \"benchmarks\": [\n");
+
+    for (size_t i = 0; i < results.size(); i++) {
+        const bench_result& r = results[i];
+        double ops_per_sec = (r.total_ns > 0.0) ? 1e9 * (double)r.ops / r.total_ns : 0.0;
+
+        fprintf(file, "    {\"name\": \"%s\", \"ops\": %zu, \"total_ns\": %.0f, \"ops_per_sec\": %.1f, "
+            "\"p50_ns\": %.1f, \"p90_ns\": %.1f, \"p99_ns\": %.1f, \"max_ns\": %.1f}%s\n",
+            r.name.c_str(), r.ops, r.total_ns, ops_per_sec, r.p50_ns, r.p90_ns, r.p99_ns, r.max_ns,
+            (i + 1 < results.size()) ? "," : "");
+    }
+
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    return true;
+}
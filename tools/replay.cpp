@@ -0,0 +1,161 @@
+#include "../src/occl_cull.h"
+#include "../src/occl_capture.h"
+#include "../src/occl_trace.h"
+#include "bench_util.h"
+#include <stdlib.h>
+
+// Replays a capture written by Occl_Cull_Context::start_capture against a
+// fresh context and reports the build and per frame culling times.
+//
+//   replay <capture> [iterations] [out.json] [temporal|incremental] [trace.json]
+//
+// The trace of the last frames is only written if built with OCCL_TRACE.
+
+struct replay_timers {
+    bench_timer build;
+    bench_timer frame;
+    bench_timer flag;
+};
+
+bool replay(Occl_Capture_Reader& reader, replay_timers& timers, Occl_Cull_Stats& stats, bool temporal, bool incremental) {
+    Occl_Cull_Context ctx(reader.reserve, reader.clip_box);
+    ctx.view.temporal = temporal;
+    ctx.view.incremental = incremental;
+    Occl_Capture_Record record;
+
+    // A frame spans from one begin_frame to the next, flags before the first one count as a frame as well.
+    double build_ns = 0.0, frame_ns = 0.0;
+    bool frame_open = false;
+
+    reader.rewind();
+    while (reader.next(record)) {
+        switch (record.tag) {
+            case Occl_Capture_Tag::ADD_MESH:
+            case Occl_Capture_Tag::ADD_SECTOR_MESH: {
+                if (ctx.free_slots.empty() && ctx.meshes.size() >= ctx.reserved) {
+                    print_error("Capture adds more meshes than its reserve of %zu.\n", ctx.reserved);
+                    return false;
+                }
+
+                bench_clock::time_point start = bench_clock::now();
+                ctx.add_mesh(record.convex_hull, record.sector);
+                build_ns += ns_since(start);
+            } break;
+            case Occl_Capture_Tag::UNLOAD_SECTOR: {
+                bench_clock::time_point start = bench_clock::now();
+                ctx.unload_sector(record.sector);
+                build_ns += ns_since(start);
+            } break;
+            case Occl_Capture_Tag::UPDATE_MESH: {
+                if (record.index < 0 || record.index >= (int)ctx.meshes.size() || ctx.mesh_sectors[record.index] < 0) {
+                    print_error("Capture updates unknown mesh %d.\n", record.index);
+                    return false;
+                }
+
+                bench_clock::time_point start = bench_clock::now();
+                ctx.update_mesh(record.index, record.convex_hull);
+                build_ns += ns_since(start);
+            } break;
+            case Occl_Capture_Tag::MARK_DIRTY:
+                ctx.mark_dirty(record.bbox);
+                break;
+            case Occl_Capture_Tag::FLAG_MESH: {
+                if (record.index < 0 || record.index >= (int)ctx.meshes.size()) {
+                    print_error("Capture flags unknown mesh %d.\n", record.index);
+                    return false;
+                }
+
+                timers.flag.begin();
+                ctx.flag_mesh(record.index, record.flag);
+                timers.flag.end();
+
+                frame_ns += timers.flag.samples.back();
+                frame_open = true;
+            } break;
+            case Occl_Capture_Tag::BEGIN_FRAME: {
+                if (frame_open) {
+                    timers.frame.samples.push_back(frame_ns);
+                }
+
+                bench_clock::time_point start = bench_clock::now();
+                ctx.begin_frame();
+                frame_ns = ns_since(start);
+                frame_open = true;
+            } break;
+            case Occl_Capture_Tag::SELECT_OCCLUDERS: {
+                for (int index: record.candidates) {
+                    if (index < 0 || index >= (int)ctx.meshes.size()) {
+                        print_error("Capture selects unknown mesh %d.\n", index);
+                        return false;
+                    }
+                }
+
+                bench_clock::time_point start = bench_clock::now();
+                ctx.view.occluder_budget = record.budget;
+                ctx.select_occluders(record.candidates);
+                frame_ns += ns_since(start);
+            } break;
+            case Occl_Capture_Tag::END_FRAME: {
+                bench_clock::time_point start = bench_clock::now();
+                ctx.end_frame();
+                frame_ns += ns_since(start);
+            } break;
+        }
+    }
+
+    if (frame_open) {
+        timers.frame.samples.push_back(frame_ns);
+    }
+
+    timers.build.samples.push_back(build_ns);
+    stats = ctx.snapshot_stats();
+    return reader.cursor == reader.size;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        print_error("Usage: %s <capture> [iterations] [out.json] [temporal|incremental] [trace.json]\n", argv[0]);
+        return 1;
+    }
+
+    int iterations = (argc > 2) ? atoi(argv[2]) : 1;
+    const char *out_path = (argc > 3) ? argv[3] : "bin/replay.json";
+    bool temporal = (argc > 4) && strcmp(argv[4], "temporal") == 0;
+    bool incremental = (argc > 4) && strcmp(argv[4], "incremental") == 0;
+    const char *trace_path = (argc > 5) ? argv[5] : null;
+
+    if (trace_path != null && !OCCL_TRACE) {
+        print_error("Built without OCCL_TRACE, '%s' is not written.\n", trace_path);
+        trace_path = null;
+    }
+
+    Occl_Capture_Reader reader;
+    if (!reader.open(argv[1])) {
+        return 1;
+    }
+
+    replay_timers timers;
+    Occl_Cull_Stats stats = {};
+
+    for (int i = 0; i < iterations; i++) {
+        if (!replay(reader, timers, stats, temporal, incremental)) {
+            print_error("Replay stopped early at offset %zu of %zu.\n", reader.cursor, reader.size);
+            return 1;
+        }
+    }
+
+    std::vector<bench_result> results = {
+        summarize("replay_build", timers.build),
+        summarize("replay_frame", timers.frame),
+        summarize("replay_flag_mesh", timers.flag)
+    };
+
+    print(results);
+    print(stats);
+
+    if (trace_path != null && !occl_trace_dump(trace_path)) {
+        return 1;
+    }
+
+    return write_json(out_path, results) ? 0 : 1;
+}
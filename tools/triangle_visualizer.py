@@ -1,5 +1,5 @@
 #!/usr/bin/python3
-import sys
+import sys, json
 import re, numpy as np
 import matplotlib.pyplot as plt
 
@@ -34,12 +34,57 @@ def plot(triangles, points):
     plt.autoscale(True)
     plt.show()
 
+def plot_heatmap(path, metric="cycles", grid=128):
+    # Renders the JSON written by Occl_Cull_Context::export_heatmap. The cost of
+    # every draw mesh is spread evenly over the grid cells its bbox overlaps.
+    with open(path) as f:
+        data = json.load(f)
+
+    x0, y0, x1, y1 = data["clip_box"]
+    cell_w, cell_h = (x1 - x0) / grid, (y1 - y0) / grid
+    heat = np.zeros((grid, grid))
+
+    for mesh in data["meshes"]:
+        cost = mesh[metric]
+        if cost == 0:
+            continue
+
+        mx0, my0, mx1, my1 = mesh["bbox"]
+        c0 = int(np.clip((mx0 - x0) / cell_w, 0, grid - 1))
+        c1 = int(np.clip((mx1 - x0) / cell_w, 0, grid - 1))
+        r0 = int(np.clip((my0 - y0) / cell_h, 0, grid - 1))
+        r1 = int(np.clip((my1 - y0) / cell_h, 0, grid - 1))
+        heat[r0:r1 + 1, c0:c1 + 1] += cost / ((r1 - r0 + 1) * (c1 - c0 + 1))
+
+    plt.figure()
+    image = plt.imshow(heat, origin="lower", extent=(x0, x1, y0, y1), cmap="inferno", interpolation="nearest")
+    plt.colorbar(image, label=metric)
+
+    for node in data["draw_nodes"]:
+        nx0, ny0, nx1, ny1 = node["bbox"]
+        plt.gca().add_patch(plt.Rectangle((nx0, ny0), nx1 - nx0, ny1 - ny0, fill=False, color="gray", linewidth=0.3, alpha=0.6))
+
+    for hull in data["occluders"]:
+        plt.gca().add_patch(plt.Polygon(hull, fill=False, color="cyan", linewidth=0.8))
+
+    plt.xlim(x0, x1)
+    plt.ylim(y0, y1)
+    plt.title(f"{metric} per draw mesh, {len(data['occluders'])} occluders")
+    plt.show()
+
 def get_numbers(str):
     numbers = re.findall('-?(?:\d+(?:\.\d+)?(?:e-?\d+)?)|inf|nan', str)
     numbers = np.array([float(n) for n in numbers])
     return numbers
 
 if __name__ == "__main__":
+    if sys.argv[1] == "--heatmap":
+        # ./triangle_visualizer.py --heatmap export.json [cycles|subtractions|slow_tests] [grid]
+        metric = sys.argv[3] if len(sys.argv) > 3 else "cycles"
+        grid = int(sys.argv[4]) if len(sys.argv) > 4 else 128
+        plot_heatmap(sys.argv[2], metric, grid)
+        sys.exit(0)
+
     triangle_list = get_numbers(sys.argv[1]).reshape((-1, 3, 2))
 
     if len(sys.argv) > 2: